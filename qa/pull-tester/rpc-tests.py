@@ -108,6 +108,7 @@ testScripts = [
     'wallet.py',
     'wallet-hd.py',
     'wallet-dump.py',
+    'sendbatch.py',
     'listtransactions.py',
     'receivedby.py',
     'mempool_resurrect_test.py',
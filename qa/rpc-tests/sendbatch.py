@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+# Copyright (c) 2016 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Exercise sendbatch: a payout split over several transactions, the amounts
+# and fee it reports, and failures that must leave the wallet unchanged.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+# More recipients than the outputs of one standard transaction can hold
+NUM_RECIPIENTS = 1600
+
+class SendBatchTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = False
+        self.num_nodes = 2
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def check_batch(self, result, amounts):
+        """Check that the batch pays every recipient once, from disjoint inputs, for the fee it reports"""
+        node = self.nodes[0]
+        paid = {}
+        spent = set()
+        fee = Decimal('0')
+        for txid in result['txids']:
+            tx = node.decoderawtransaction(node.gettransaction(txid)['hex'])
+            value_in = Decimal('0')
+            for txin in tx['vin']:
+                prevout = (txin['txid'], txin['vout'])
+                assert(prevout not in spent)
+                spent.add(prevout)
+                prevtx = node.decoderawtransaction(node.gettransaction(txin['txid'])['hex'])
+                value_in += prevtx['vout'][txin['vout']]['value']
+            value_out = Decimal('0')
+            for txout in tx['vout']:
+                value_out += txout['value']
+                address = txout['scriptPubKey']['addresses'][0]
+                if address in amounts:
+                    assert(address not in paid)
+                    paid[address] = txout['value']
+            assert_equal(node.gettransaction(txid)['fee'], value_out - value_in)
+            fee += value_in - value_out
+        assert_equal(paid, amounts)
+        assert_equal(fee, result['fee'])
+
+    def assert_batch_fails(self, amounts, code):
+        """Check that sendbatch fails with the error code, adding no transaction and keeping every key"""
+        node = self.nodes[0]
+        walletinfo = node.getwalletinfo()
+        try:
+            node.sendbatch(amounts)
+            raise AssertionError('sendbatch should have failed')
+        except JSONRPCException as e:
+            assert_equal(e.error['code'], code)
+        walletinfo_after = node.getwalletinfo()
+        assert_equal(walletinfo_after['txcount'], walletinfo['txcount'])
+        assert_equal(walletinfo_after['balance'], walletinfo['balance'])
+        assert_equal(walletinfo_after['keypoolsize'], walletinfo['keypoolsize'])
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        print("Paying %d recipients..." % NUM_RECIPIENTS)
+        amounts = {}
+        for i in range(NUM_RECIPIENTS):
+            amounts[self.nodes[1].getnewaddress()] = Decimal('0.01') + Decimal(i % 100) / 10000
+        total = sum(amounts.values())
+        balance = node.getbalance()
+
+        result = node.sendbatch(amounts, "payout")
+        assert(len(result['txids']) > 1)
+        self.check_batch(result, amounts)
+        assert_equal(node.getbalance(), balance - total - result['fee'])
+        for txid in result['txids']:
+            assert_equal(node.gettransaction(txid)['comment'], "payout")
+
+        self.sync_all()
+        node.generate(1)
+        self.sync_all()
+        for txid in result['txids']:
+            assert_equal(node.gettransaction(txid)['confirmations'], 1)
+        received = self.nodes[1].listunspent(1, 9999999, list(amounts.keys()))
+        assert_equal(len(received), NUM_RECIPIENTS)
+        assert_equal(sum(utxo['amount'] for utxo in received), total)
+
+        print("Checking insufficient funds...")
+        address = self.nodes[1].getnewaddress()
+        self.assert_batch_fails({address: node.getbalance() + 1}, -6)
+        # Enough for the amounts, but not for the fee on top of them
+        self.assert_batch_fails({address: node.getbalance()}, -6)
+
+        print("Checking a locked wallet with a drained keypool...")
+        node.encryptwallet('test')
+        bitcoind_processes[0].wait()
+        self.nodes[0] = node = start_node(0, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        try:
+            while True:
+                node.getrawchangeaddress()
+        except JSONRPCException as e:
+            assert_equal(e.error['code'], -12)
+        self.assert_batch_fails({address: 1}, -13)
+
+        # Unlocking refills the keypool, so the batch can take its change keys again.
+        node.walletpassphrase('test', 600)
+        amounts = {self.nodes[1].getnewaddress(): Decimal('1.5'), self.nodes[1].getnewaddress(): Decimal('2.5')}
+        result = node.sendbatch(amounts)
+        assert_equal(len(result['txids']), 1)
+        self.check_batch(result, amounts)
+
+if __name__ == '__main__':
+    SendBatchTest().main()
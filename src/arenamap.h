@@ -0,0 +1,275 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ARENAMAP_H
+#define BITCOIN_ARENAMAP_H
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* Hash map with open addressing, whose entries are allocated from an arena.
+ *
+ * The table is a flat array of (hash, entry pointer) slots probed linearly, so
+ * a lookup only dereferences an entry whose full hash matches. Entries are
+ * carved out of chunks that grow geometrically up to MAX_CHUNK_ENTRIES, instead
+ * of one heap allocation per entry; erased entries are recycled through a free
+ * list and all chunks are released at once by clear().
+ *
+ * Differs from std::unordered_map in that:
+ * - Erasing leaves a tombstone, so it invalidates no iterator but the erased
+ *   one, and a map can be emptied while iterating over it.
+ * - Growing the table invalidates iterators, but never moves entries: pointers
+ *   and references to values stay valid until the entry is erased or the map
+ *   is cleared. erase() accepts an iterator obtained before the table grew.
+ */
+template <typename K, typename T, typename Hash>
+class arenamap {
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+    static const size_t MIN_CHUNK_ENTRIES = 16;
+    static const size_t MAX_CHUNK_ENTRIES = 4096;
+    static const size_t MIN_BUCKETS = 16;
+
+    struct slot {
+        size_t hash;
+        value_type* entry; //!< NULL for an empty slot (hash == 0) or a tombstone (hash == 1)
+    };
+
+private:
+    Hash hasher;
+    slot* table;
+    size_t nBuckets;     //!< Size of table, 0 or a power of two
+    size_t nSize;        //!< Number of entries
+    size_t nTombstones;  //!< Number of erased slots in table
+
+    std::vector<std::pair<value_type*, size_t> > vChunks; //!< Arena chunks and their capacity in entries
+    size_t nChunkUsed;   //!< Entries handed out from the last chunk
+    void* pFree;         //!< Free list of erased entries, linked through their storage
+
+    template <bool Const>
+    class iterator_base {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename arenamap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+        typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+
+    private:
+        friend class arenamap;
+        template <bool> friend class iterator_base;
+        typedef typename std::conditional<Const, const slot*, slot*>::type slot_ptr;
+        slot_ptr pos;
+        slot_ptr last;
+        value_type* entry;
+
+        iterator_base(slot_ptr posIn, slot_ptr lastIn) : pos(posIn), last(lastIn), entry(NULL) { Skip(); }
+        void Skip() {
+            while (pos != last && !pos->entry)
+                ++pos;
+            entry = pos != last ? pos->entry : NULL;
+        }
+
+    public:
+        iterator_base() : pos(NULL), last(NULL), entry(NULL) {}
+        // iterator to const_iterator conversion
+        template <bool OtherConst, typename = typename std::enable_if<Const && !OtherConst>::type>
+        iterator_base(const iterator_base<OtherConst>& other) : pos(other.pos), last(other.last), entry(other.entry) {}
+
+        reference operator*() const { return *entry; }
+        pointer operator->() const { return entry; }
+        iterator_base& operator++() { ++pos; Skip(); return *this; }
+        iterator_base operator++(int) { iterator_base copy(*this); ++(*this); return copy; }
+        bool operator==(const iterator_base& other) const { return entry == other.entry; }
+        bool operator!=(const iterator_base& other) const { return entry != other.entry; }
+    };
+
+    /** Slot holding key, or the slot it would be inserted in if it is not present */
+    slot* Probe(const K& key, size_t hash, bool& fFound) const {
+        slot* pInsert = NULL;
+        for (size_t i = hash & (nBuckets - 1); ; i = (i + 1) & (nBuckets - 1)) {
+            slot* s = &table[i];
+            if (!s->entry) {
+                if (s->hash == 0) {
+                    fFound = false;
+                    return pInsert ? pInsert : s;
+                }
+                if (!pInsert)
+                    pInsert = s;
+            } else if (s->hash == hash && s->entry->first == key) {
+                fFound = true;
+                return s;
+            }
+        }
+    }
+
+    void Rehash(size_t nNewBuckets) {
+        slot* old = table;
+        size_t nOld = nBuckets;
+        table = new slot[nNewBuckets]();
+        nBuckets = nNewBuckets;
+        nTombstones = 0;
+        for (size_t i = 0; i < nOld; i++) {
+            if (!old[i].entry)
+                continue;
+            size_t j = old[i].hash & (nBuckets - 1);
+            while (table[j].entry)
+                j = (j + 1) & (nBuckets - 1);
+            table[j] = old[i];
+        }
+        delete[] old;
+    }
+
+    /** Make room for one more entry, keeping the table at most 3/4 full including tombstones */
+    void Reserve() {
+        if ((nSize + nTombstones + 1) * 4 <= nBuckets * 3)
+            return;
+        size_t nNewBuckets = nBuckets ? nBuckets : MIN_BUCKETS;
+        while ((nSize + 1) * 2 > nNewBuckets)
+            nNewBuckets *= 2;
+        Rehash(nNewBuckets);
+    }
+
+    value_type* Allocate() {
+        if (pFree) {
+            value_type* p = static_cast<value_type*>(pFree);
+            pFree = *static_cast<void**>(pFree);
+            return p;
+        }
+        if (vChunks.empty() || nChunkUsed == vChunks.back().second) {
+            size_t nEntries = vChunks.empty() ? MIN_CHUNK_ENTRIES : std::min(vChunks.back().second * 2, (size_t)MAX_CHUNK_ENTRIES);
+            vChunks.push_back(std::make_pair(static_cast<value_type*>(::operator new(nEntries * sizeof(value_type))), nEntries));
+            nChunkUsed = 0;
+        }
+        return vChunks.back().first + nChunkUsed++;
+    }
+
+    void Deallocate(value_type* p) {
+        p->~value_type();
+        *reinterpret_cast<void**>(p) = pFree;
+        pFree = p;
+    }
+
+    void ReleaseChunks() {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i].first);
+        vChunks.clear();
+        nChunkUsed = 0;
+        pFree = NULL;
+    }
+
+    static_assert(sizeof(value_type) >= sizeof(void*), "erased entries must fit a free list pointer");
+
+public:
+    typedef iterator_base<false> iterator;
+    typedef iterator_base<true> const_iterator;
+
+    arenamap() : table(NULL), nBuckets(0), nSize(0), nTombstones(0), nChunkUsed(0), pFree(NULL) {}
+    ~arenamap() {
+        clear();
+        delete[] table;
+    }
+
+    arenamap(const arenamap&) = delete;
+    arenamap& operator=(const arenamap&) = delete;
+
+    iterator begin() { return iterator(table, table + nBuckets); }
+    iterator end() { return iterator(table + nBuckets, table + nBuckets); }
+    const_iterator begin() const { return const_iterator(table, table + nBuckets); }
+    const_iterator end() const { return const_iterator(table + nBuckets, table + nBuckets); }
+
+    bool empty() const { return nSize == 0; }
+    size_type size() const { return nSize; }
+
+    iterator find(const K& key) {
+        if (nSize == 0)
+            return end();
+        bool fFound;
+        slot* s = Probe(key, hasher(key), fFound);
+        return fFound ? iterator(s, table + nBuckets) : end();
+    }
+    const_iterator find(const K& key) const { return const_cast<arenamap*>(this)->find(key); }
+    size_type count(const K& key) const { return find(key) != end(); }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        Reserve();
+        size_t hash = hasher(value.first);
+        bool fFound;
+        slot* s = Probe(value.first, hash, fFound);
+        if (fFound)
+            return std::make_pair(iterator(s, table + nBuckets), false);
+        value_type* p = Allocate();
+        new (p) value_type(value);
+        if (s->hash == 1)
+            nTombstones--;
+        s->hash = hash;
+        s->entry = p;
+        nSize++;
+        return std::make_pair(iterator(s, table + nBuckets), true);
+    }
+
+    T& operator[](const K& key) { return insert(value_type(key, T())).first->second; }
+
+    void erase(iterator it) {
+        slot* s = it.pos;
+        if (std::less<slot*>()(s, table) || !std::less<slot*>()(s, table + nBuckets) || s->entry != it.entry) {
+            // The table was grown since the iterator was obtained
+            bool fFound;
+            s = Probe(it.entry->first, hasher(it.entry->first), fFound);
+            assert(fFound);
+        }
+        Deallocate(s->entry);
+        s->entry = NULL;
+        s->hash = 1;
+        nSize--;
+        nTombstones++;
+    }
+    size_type erase(const K& key) {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    /** Remove all entries and release the arena. The table keeps its size. */
+    void clear() {
+        // Destroy entries in arena order rather than table order, so that the
+        // entries (and whatever they own) are visited sequentially.
+        std::vector<value_type*> vEntries;
+        vEntries.reserve(nSize);
+        for (size_t i = 0; i < nBuckets; i++) {
+            if (table[i].entry)
+                vEntries.push_back(table[i].entry);
+            table[i].hash = 0;
+            table[i].entry = NULL;
+        }
+        std::sort(vEntries.begin(), vEntries.end(), std::less<value_type*>());
+        for (size_t i = 0; i < vEntries.size(); i++)
+            vEntries[i]->~value_type();
+        nSize = 0;
+        nTombstones = 0;
+        ReleaseChunks();
+    }
+
+    // Memory accounting, see memusage::DynamicUsage
+    size_t bucket_count() const { return nBuckets; }
+    size_t chunk_count() const { return vChunks.size(); }
+    size_t chunk_capacity() const { return vChunks.capacity(); }
+    size_t chunk_bytes(size_t i) const { return vChunks[i].second * sizeof(value_type); }
+};
+
+#endif // BITCOIN_ARENAMAP_H
@@ -168,6 +168,7 @@ public:
 
     base_uint& operator*=(uint32_t b32);
     base_uint& operator*=(const base_uint& b);
+    base_uint& operator/=(uint32_t b32);
     base_uint& operator/=(const base_uint& b);
 
     base_uint& operator++()
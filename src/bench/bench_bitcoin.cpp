@@ -4,16 +4,21 @@
 
 #include "bench.h"
 
+#include "crypto/scrypt.h"
 #include "key.h"
 #include "main.h"
 #include "util.h"
 
+#include <iostream>
+
 int
 main(int argc, char** argv)
 {
     ECC_Start();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
+    // Select the scrypt backends as mooncoind does, so the PoW benchmarks time them
+    std::cout << "#Using scrypt implementation: " << scrypt_detect_cpu() << "\n";
 
     benchmark::BenchRunner::RunAll();
 
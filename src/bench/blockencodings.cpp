@@ -0,0 +1,62 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "blockencodings.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "txmempool.h"
+
+/* Mempool size the reconstruction is measured against */
+static const size_t RECONSTRUCT_MEMPOOL_USAGE = 300 * 1000 * 1000;
+/* Transactions of the compact block found in the mempool, and missing from it */
+static const int RECONSTRUCT_BLOCK_TXS = 2500;
+static const int RECONSTRUCT_MISSING_TXS = 25;
+
+static CMutableTransaction MakeReconstructTx(uint32_t n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(SerializeHash(n), 0);
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, n & 0xff) << std::vector<unsigned char>(33, 2);
+    tx.vout.resize(2);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue = 100000 + n;
+        tx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
+
+/**
+ * Initialize a PartiallyDownloadedBlock from a cmpctblock against a 300MB
+ * mempool. The block has up to RECONSTRUCT_BLOCK_TXS transactions from the
+ * mempool and RECONSTRUCT_MISSING_TXS that are not in it, so every iteration
+ * scans all of the mempool, as it does for most blocks in practice.
+ */
+static void CompactBlockReconstruct(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block;
+    block.nBits = 0x1e0ffff0;
+    block.vtx.push_back(MakeReconstructTx(0));
+    uint32_t n = 1;
+    for (; pool.DynamicMemoryUsage() < RECONSTRUCT_MEMPOOL_USAGE; n++) {
+        CTransaction tx(MakeReconstructTx(n));
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 1000, 0, 0, 1, true, 0, false, 4, LockPoints()), false);
+        if (n % 97 == 0 && block.vtx.size() <= RECONSTRUCT_BLOCK_TXS)
+            block.vtx.push_back(tx);
+    }
+    for (int i = 0; i < RECONSTRUCT_MISSING_TXS; i++)
+        block.vtx.push_back(MakeReconstructTx(n + i));
+
+    CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ReadStatus status = partialBlock.InitData(cmpctblock);
+        assert(status == READ_STATUS_OK);
+    }
+}
+
+BENCHMARK(CompactBlockReconstruct);
@@ -0,0 +1,118 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "random.h"
+#include "wallet/coinselection.h"
+#include "wallet/wallet.h"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <vector>
+
+#include <boost/foreach.hpp>
+
+/* Outputs in the synthetic large wallet, as a busy payout wallet holds */
+static const int LARGE_WALLET_COINS = 200000;
+
+static void addCoin(const CAmount& nValue, const CWallet& wallet, std::vector<COutput>& vCoins)
+{
+    int nInput = 0;
+    static int nextLockTime = 0;
+    CMutableTransaction tx;
+    tx.nLockTime = nextLockTime++; // so all transactions get different hashes
+    tx.vout.resize(nInput + 1);
+    tx.vout[nInput].nValue = nValue;
+    CWalletTx* wtx = new CWalletTx(&wallet, tx);
+    int nAge = 6 * 24;
+    COutput output(wtx, nInput, nAge, true, true);
+    vCoins.push_back(output);
+}
+
+static void emptyWallet(std::vector<COutput>& vCoins)
+{
+    BOOST_FOREACH (COutput output, vCoins)
+        delete output.tx;
+    vCoins.clear();
+}
+
+/* Values spread over four orders of magnitude, as payouts and their change are */
+static CAmount RandomValue()
+{
+    return (1 + insecure_rand() % 10000) * (CENT / 10) * (1 + insecure_rand() % 4);
+}
+
+// Simple benchmark for wallet coin selection. Note that it maybe be necessary
+// to build up more complicated scenarios in order to get meaningful
+// measurements of performance. From laanwj, "Wallet coin selection is probably
+// the hardest, as you need a wider selection of scenarios, just testing the
+// same one over and over isn't too useful. Generating random isn't useful
+// either for measurements."
+// (https://github.com/bitcoin/bitcoin/issues/7883#issuecomment-224807484)
+static void CoinSelection(benchmark::State& state)
+{
+    const CWallet wallet;
+    std::vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    while (state.KeepRunning()) {
+        emptyWallet(vCoins);
+
+        // Add coins.
+        for (int i = 0; i < 1000; i++)
+            addCoin(1000 * COIN, wallet, vCoins);
+        addCoin(3 * COIN, wallet, vCoins);
+
+        std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+        CAmount nValueRet;
+        bool success = wallet.SelectCoinsMinConf(1003 * COIN, 1, 6, 0, vCoins, setCoinsRet, nValueRet);
+        assert(success);
+        assert(nValueRet == 1003 * COIN);
+        assert(setCoinsRet.size() == 2);
+    }
+    emptyWallet(vCoins);
+}
+
+// The stochastic selection over a wallet of LARGE_WALLET_COINS outputs, for
+// targets that take many of the smaller coins.
+static void CoinSelectionLargeWallet(benchmark::State& state)
+{
+    const CWallet wallet;
+    std::vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    seed_insecure_rand(true);
+    for (int i = 0; i < LARGE_WALLET_COINS; i++)
+        addCoin(RandomValue(), wallet, vCoins);
+
+    while (state.KeepRunning()) {
+        std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+        CAmount nValueRet;
+        bool success = wallet.SelectCoinsMinConf(50 * COIN + insecure_rand() % COIN, 1, 6, 0, vCoins, setCoinsRet, nValueRet);
+        assert(success);
+    }
+    emptyWallet(vCoins);
+}
+
+// The branch and bound search over the effective values of the same wallet,
+// sorted once as SelectCoins does.
+static void CoinSelectionBnBLargeWallet(benchmark::State& state)
+{
+    seed_insecure_rand(true);
+    std::vector<CAmount> vValues;
+    for (int i = 0; i < LARGE_WALLET_COINS; i++)
+        vValues.push_back(RandomValue() - 148 * 100);
+    std::sort(vValues.begin(), vValues.end(), std::greater<CAmount>());
+
+    while (state.KeepRunning()) {
+        std::vector<size_t> vSelected;
+        CAmount nValueRet;
+        SelectCoinsBnB(vValues, 50 * COIN + insecure_rand() % COIN, (34 + 148) * 100, vSelected, nValueRet);
+    }
+}
+
+BENCHMARK(CoinSelection);
+BENCHMARK(CoinSelectionLargeWallet);
+BENCHMARK(CoinSelectionBnBLargeWallet);
@@ -0,0 +1,66 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "coins.h"
+#include "hash.h"
+#include "script/script.h"
+
+#include <vector>
+
+/* Transactions (of two outputs each) in the cache the lookups run against */
+static const uint32_t COINS_CACHE_TXS = 200000;
+/* Transactions added and flushed per flush benchmark iteration */
+static const uint32_t COINS_FLUSH_TXS = 5000;
+
+static void AddBenchCoins(CCoinsViewCache& cache, const uint256& txid, uint32_t n)
+{
+    for (uint32_t i = 0; i < 2; i++) {
+        CTxOut out(100000 + n, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, n & 0xff) << OP_EQUALVERIFY << OP_CHECKSIG);
+        cache.AddCoin(COutPoint(txid, i), Coin(std::move(out), n, false), false);
+    }
+}
+
+static void CoinsCacheLookup(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    std::vector<uint256> vTxids;
+    for (uint32_t n = 0; n < COINS_CACHE_TXS; n++) {
+        vTxids.push_back(SerializeHash(n));
+        AddBenchCoins(cache, vTxids.back(), n);
+    }
+    uint32_t nRand = 0x5eed;
+    CAmount nTotal = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            nRand = nRand * 1103515245 + 12345;
+            nTotal += cache.AccessCoin(COutPoint(vTxids[nRand % vTxids.size()], 0)).out.nValue;
+        }
+    }
+}
+
+/**
+ * Build a block's worth of new coins in a child cache and flush them into
+ * the parent, as ConnectTip does, then flush the parent (to a view that
+ * discards them), as FlushStateToDisk does.
+ */
+static void CoinsCacheFlush(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache parent(&base);
+    uint32_t n = 0;
+    while (state.KeepRunning()) {
+        {
+            CCoinsViewCache child(&parent);
+            for (uint32_t i = 0; i < COINS_FLUSH_TXS; i++, n++)
+                AddBenchCoins(child, SerializeHash(n), n);
+            child.Flush();
+        }
+        parent.Flush();
+    }
+}
+
+BENCHMARK(CoinsCacheLookup);
+BENCHMARK(CoinsCacheFlush);
@@ -0,0 +1,86 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "primitives/block.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+#include "crypto/scrypt.h"
+#include "balloon/balloonpow.h"
+#include "lyra2m/Lyra2.h"
+
+#include <vector>
+
+/* Number of headers hashed per batch in the GetPoWHashes benchmark */
+static const size_t POW_BATCH_SIZE = 64;
+
+static CBlockHeader BenchHeader(uint32_t nNonce)
+{
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = uint256S("0xa1b2c3d4e5f60718293a4b5c6d7e8f90a1b2c3d4e5f60718293a4b5c6d7e8f90");
+    header.hashMerkleRoot = uint256S("0x0f1e2d3c4b5a69788796a5b4c3d2e1f00f1e2d3c4b5a69788796a5b4c3d2e1f0");
+    header.nTime = 1500000000;
+    header.nBits = 0x1e0ffff0;
+    header.nNonce = nNonce;
+    return header;
+}
+
+static void Scrypt_1024_1_1_256(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader(0);
+    uint256 hash;
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256(BEGIN(header.nVersion), BEGIN(hash));
+        header.nNonce++;
+    }
+}
+
+static void GetPoWHash(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader(0);
+    while (state.KeepRunning()) {
+        header.GetPoWHash(false);
+        header.nNonce++;
+    }
+}
+
+static void GetPoWHashes_Batch(benchmark::State& state)
+{
+    std::vector<CBlockHeader> headers;
+    for (size_t i = 0; i < POW_BATCH_SIZE; i++)
+        headers.push_back(BenchHeader(i));
+    std::vector<uint256> hashes;
+    while (state.KeepRunning()) {
+        GetPoWHashes(headers, hashes);
+        headers[0].nNonce++;
+    }
+}
+
+static void BalloonPoW(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader(0);
+    uint256 hash;
+    while (state.KeepRunning()) {
+        balloonpow_hash(BEGIN(header.nVersion), BEGIN(hash));
+        header.nNonce++;
+    }
+}
+
+static void Lyra2(benchmark::State& state)
+{
+    // Parameters as used by Lyra2REv2: 32-byte key and input, one pass over a 4x4 matrix.
+    uint256 in = BenchHeader(0).GetHash();
+    uint256 out;
+    while (state.KeepRunning()) {
+        LYRA2(out.begin(), 32, in.begin(), 32, in.begin(), 32, 1, 4, 4);
+        in = out;
+    }
+}
+
+BENCHMARK(Scrypt_1024_1_1_256);
+BENCHMARK(GetPoWHash);
+BENCHMARK(GetPoWHashes_Batch);
+BENCHMARK(BalloonPoW);
+BENCHMARK(Lyra2);
@@ -0,0 +1,108 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "chainparamsbase.h"
+#include "pow.h"
+
+#include <vector>
+
+/* Blocks in each synthetic chain; enough for the longest KGW window (7 days) */
+static const int RETARGET_CHAIN_LENGTH = 8000;
+
+/**
+ * A synthetic chain of RETARGET_CHAIN_LENGTH block index entries whose tip is
+ * at nTipHeight, with jittered timestamps and targets so that every retarget
+ * algorithm walks its full window.
+ *
+ * Each chain gets block hashes of its own, so that the retarget caches, which
+ * are keyed on block hashes, never serve one benchmark a result computed on
+ * another's chain.
+ */
+class CBenchChain
+{
+public:
+    std::vector<uint256> hashes;
+    std::vector<CBlockIndex> blocks;
+
+    explicit CBenchChain(int nTipHeight) : hashes(RETARGET_CHAIN_LENGTH), blocks(RETARGET_CHAIN_LENGTH)
+    {
+        static uint32_t nChains = 0;
+        arith_uint256 hashChain = arith_uint256(++nChains) << 128;
+        uint32_t nRand = 0x5eed;
+        uint32_t nTime = 1500000000;
+        for (int i = 0; i < RETARGET_CHAIN_LENGTH; i++) {
+            nRand = nRand * 1103515245 + 12345;
+            nTime += 30 + (nRand >> 16) % 120;
+            hashes[i] = ArithToUint256(hashChain + (i + 1));
+            blocks[i].phashBlock = &hashes[i];
+            blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+            blocks[i].nHeight = nTipHeight - RETARGET_CHAIN_LENGTH + 1 + i;
+            blocks[i].nTime = nTime;
+            blocks[i].nBits = 0x1d100000 + (nRand & 0xfffff);
+        }
+    }
+
+    const CBlockIndex* Tip(int nBack) const { return &blocks[RETARGET_CHAIN_LENGTH - 1 - nBack]; }
+};
+
+/**
+ * Run GetNextWorkRequired on nTips consecutive tips, nStep blocks apart,
+ * starting nTipHeight. Changing the tip every call keeps the KGW window memo
+ * from turning the benchmark into a cache lookup.
+ */
+static void RetargetBench(benchmark::State& state, int nTipHeight, int nTips, int nStep)
+{
+    const Consensus::Params& params = Params(CBaseChainParams::MAIN).GetConsensus();
+    CBenchChain chain(nTipHeight);
+    CBlockHeader header;
+    int n = 0;
+    while (state.KeepRunning()) {
+        const CBlockIndex* pindexLast = chain.Tip((n++ % nTips) * nStep);
+        header.nTime = pindexLast->nTime + 90;
+        GetNextWorkRequired(pindexLast, &header, params);
+    }
+}
+
+static void GetNextWorkRequired_V1(benchmark::State& state)
+{
+    // Only every 320th block retargets, so step from one boundary to the next.
+    RetargetBench(state, 20479, 20, Params(CBaseChainParams::MAIN).GetConsensus().DifficultyAdjustmentInterval());
+}
+
+static void GetNextWorkRequired_KGW(benchmark::State& state)
+{
+    RetargetBench(state, 500000, 1000, 1);
+}
+
+static void GetNextWorkRequired_DigiShield(benchmark::State& state)
+{
+    RetargetBench(state, 1200000, 1000, 1);
+}
+
+static void GetNextWorkRequired_AlgoFork(benchmark::State& state)
+{
+    RetargetBench(state, AlgoForkHeight + 6, 8, 1);
+}
+
+static void GetNextWorkRequired_DualKGW3(benchmark::State& state)
+{
+    RetargetBench(state, AlgoForkHeight + 50000, 1000, 1);
+}
+
+static void GetNextWorkRequired_DualKGW3_SameTip(benchmark::State& state)
+{
+    // Repeated templates on one tip, as the miner and getblocktemplate do.
+    RetargetBench(state, AlgoForkHeight + 50000, 1, 1);
+}
+
+BENCHMARK(GetNextWorkRequired_V1);
+BENCHMARK(GetNextWorkRequired_KGW);
+BENCHMARK(GetNextWorkRequired_DigiShield);
+BENCHMARK(GetNextWorkRequired_AlgoFork);
+BENCHMARK(GetNextWorkRequired_DualKGW3);
+BENCHMARK(GetNextWorkRequired_DualKGW3_SameTip);
@@ -0,0 +1,53 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "cuckoocache.h"
+#include "hash.h"
+#include "script/sigcache.h"
+
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+/* Threads using the cache at once, as -par script check threads do */
+static const int SIGCACHE_THREADS = 16;
+/* Entries each thread looks up per iteration */
+static const int SIGCACHE_LOOKUPS = 20000;
+
+static void SigCacheThread(CCuckooCache& cache, const std::vector<uint256>& vEntries, int nThread)
+{
+    for (int i = 0; i < SIGCACHE_LOOKUPS; i++) {
+        const uint256& entry = vEntries[(nThread * SIGCACHE_LOOKUPS + i) % vEntries.size()];
+        if (i % 8 == 0) {
+            // A block connected: the entry is used up, then a new transaction adds it back.
+            cache.contains(entry, true);
+            cache.insert(entry);
+        } else {
+            cache.contains(entry, false);
+        }
+    }
+}
+
+/**
+ * Signature cache lookups from many threads at once, with an eighth of them
+ * erasing and reinserting their entry.
+ */
+static void SigCacheContention(benchmark::State& state)
+{
+    CCuckooCache cache(DEFAULT_MAX_SIG_CACHE_SIZE * ((size_t) 1 << 20) / 2);
+    std::vector<uint256> vEntries;
+    for (uint32_t n = 0; n < cache.capacity() / 2; n++) {
+        vEntries.push_back(SerializeHash(n));
+        cache.insert(vEntries.back());
+    }
+    while (state.KeepRunning()) {
+        boost::thread_group threads;
+        for (int t = 0; t < SIGCACHE_THREADS; t++)
+            threads.create_thread(boost::bind(&SigCacheThread, boost::ref(cache), boost::cref(vEntries), t));
+        threads.join_all();
+    }
+}
+
+BENCHMARK(SigCacheContention);
@@ -0,0 +1,40 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "main.h"
+#include "uint256.h"
+
+/* Heights evaluated per benchmark iteration */
+static const int SUBSIDY_HEIGHTS = 1000;
+
+volatile uint64_t nSubsidySum = 0; // volatile, global so not optimized away
+
+static void SubsidyBench(benchmark::State& state, int nFirstHeight)
+{
+    arith_uint256 prevHash = UintToArith256(uint256S("0x00000c5d1a3e6f7b28c9d04e1f2a3b4c5d6e7f8091a2b3c4d5e6f708192a3b4c"));
+    // Unsigned, as the sum wraps over enough iterations
+    uint64_t nTotal = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < SUBSIDY_HEIGHTS; i++) {
+            prevHash += 0x1234567;
+            nTotal += GetBlockSubsidy(nFirstHeight + i, ArithToUint256(prevHash));
+        }
+    }
+    nSubsidySum = nTotal;
+}
+
+static void GetBlockSubsidy_RandomEra(benchmark::State& state)
+{
+    SubsidyBench(state, 1);
+}
+
+static void GetBlockSubsidy_Fixed(benchmark::State& state)
+{
+    SubsidyBench(state, 1300000);
+}
+
+BENCHMARK(GetBlockSubsidy_RandomEra);
+BENCHMARK(GetBlockSubsidy_Fixed);
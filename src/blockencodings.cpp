@@ -103,11 +103,28 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     if (shorttxids.size() != cmpctblock.shorttxids.size())
         return READ_STATUS_FAILED; // Short ID collision
 
+    // Nearly all mempool transactions are not in the block. A bitmap over the
+    // low bits of the block's short IDs, with 16 bits per short ID and small
+    // enough to stay in L1, rejects all but 1 in 16 of them before shorttxids
+    // is probed, so the scan below costs little more than the SipHash itself.
+    size_t nFilterBits = 64;
+    while (nFilterBits < cmpctblock.shorttxids.size() * 16)
+        nFilterBits <<= 1;
+    const uint64_t nFilterMask = nFilterBits - 1;
+    std::vector<uint64_t> vShortIDFilter(nFilterBits / 64);
+    for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
+        uint64_t nBit = cmpctblock.shorttxids[i] & nFilterMask;
+        vShortIDFilter[nBit >> 6] |= uint64_t(1) << (nBit & 63);
+    }
+
     std::vector<bool> have_txn(txn_available.size());
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
     for (size_t i = 0; i < vTxHashes.size(); i++) {
         uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
+        uint64_t nBit = shortid & nFilterMask;
+        if (!((vShortIDFilter[nBit >> 6] >> (nBit & 63)) & 1))
+            continue;
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
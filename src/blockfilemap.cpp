@@ -0,0 +1,77 @@
+// Copyright (c) 2017 The Mooncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "main.h"
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap((void*)pdata, nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CMappedFile::Open(const boost::filesystem::path& path)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return std::shared_ptr<const CMappedFile>();
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return std::shared_ptr<const CMappedFile>();
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid without the descriptor.
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("Unable to map file %s, reading it normally\n", path.string());
+        return std::shared_ptr<const CMappedFile>();
+    }
+    return std::shared_ptr<const CMappedFile>(new CMappedFile((const char*)p, st.st_size));
+#else
+    return std::shared_ptr<const CMappedFile>();
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CBlockFileMap::Get(const char* prefix, int nFile, size_t nMinSize)
+{
+    LOCK(cs);
+    std::shared_ptr<const CMappedFile>& mapped = mapFiles[std::make_pair(std::string(prefix), nFile)];
+    if (!mapped || mapped->size() < nMinSize)
+        mapped = CMappedFile::Open(GetBlockPosFilename(CDiskBlockPos(nFile, 0), prefix));
+    return mapped;
+}
+
+void CBlockFileMap::Release(int nFile)
+{
+    LOCK(cs);
+    mapFiles.erase(std::make_pair(std::string("blk"), nFile));
+    mapFiles.erase(std::make_pair(std::string("rev"), nFile));
+}
+
+void CBlockFileMap::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+}
+
+bool BlockFileMappingSupported()
+{
+#ifndef WIN32
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2017 The Mooncoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+
+/** A read-only memory mapping of a whole file, unmapped when the last reference goes away. */
+class CMappedFile
+{
+private:
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+    const char* pdata;
+    size_t nSize;
+
+public:
+    CMappedFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    ~CMappedFile();
+
+    const char* begin() const { return pdata; }
+    const char* end() const { return pdata + nSize; }
+    size_t size() const { return nSize; }
+
+    /** Map path read-only. Returns NULL if the file is empty or cannot be mapped. */
+    static std::shared_ptr<const CMappedFile> Open(const boost::filesystem::path& path);
+};
+
+/**
+ * Shared read-only mappings of finalized blk?????.dat and rev?????.dat files,
+ * created on first use. Readers keep their mapping alive through the returned
+ * pointer, so files can be released while a read is still in progress.
+ */
+class CBlockFileMap
+{
+private:
+    CCriticalSection cs;
+    //! Keyed on (prefix, file number)
+    std::map<std::pair<std::string, int>, std::shared_ptr<const CMappedFile> > mapFiles;
+
+public:
+    /**
+     * Return the mapping of file nFile with the given prefix, mapping it if
+     * needed. nMinSize is how much of the file is known to be in use; an
+     * older, shorter mapping of a file that has since grown is replaced.
+     */
+    std::shared_ptr<const CMappedFile> Get(const char* prefix, int nFile, size_t nMinSize);
+
+    /** Drop the mappings of the blk and rev files numbered nFile (e.g. before pruning them). */
+    void Release(int nFile);
+
+    /** Drop all mappings. */
+    void Clear();
+};
+
+/** Whether this platform supports -mmapblocks */
+bool BlockFileMappingSupported();
+
+#endif // BITCOIN_BLOCKFILEMAP_H
@@ -146,6 +146,7 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+    BLOCK_POW_CHECKED       =   256, //!< header proof-of-work was verified when the index entry was created
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -69,4 +69,12 @@ namespace Checkpoints {
         return NULL;
     }
 
+    uint256 GetLastCheckpointHash(const CCheckpointData& data)
+    {
+        const MapCheckpoints& checkpoints = data.mapCheckpoints;
+        if (checkpoints.empty())
+            return uint256();
+        return checkpoints.rbegin()->second;
+    }
+
 } // namespace Checkpoints
@@ -22,6 +22,9 @@ namespace Checkpoints
 //! Returns last CBlockIndex* in mapBlockIndex that is a checkpoint
 CBlockIndex* GetLastCheckpoint(const CCheckpointData& data);
 
+//! Returns the hash of the last compiled-in checkpoint, the default -assumevalid block
+uint256 GetLastCheckpointHash(const CCheckpointData& data);
+
 double GuessVerificationProgress(const CCheckpointData& data, CBlockIndex* pindex, bool fSigchecks = true);
 
 } //namespace Checkpoints
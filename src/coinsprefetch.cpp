@@ -0,0 +1,200 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "memusage.h"
+#include "primitives/block.h"
+#include "util.h"
+
+#include <set>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView *viewIn, size_t nMaxUsageIn) :
+    CCoinsViewBacked(viewIn), nQueued(0), nStagedUsage(0), nStagedUsageOld(0), nMaxUsage(nMaxUsageIn), nWriteSequence(0), nWorkers(0) {}
+
+size_t CCoinsViewPrefetch::StagedUsage(const Coin& coin)
+{
+    return memusage::MallocUsage(sizeof(memusage::boost_unordered_node<StagedMap::value_type>)) + coin.DynamicMemoryUsage();
+}
+
+bool CCoinsViewPrefetch::Unstage(const COutPoint &outpoint, Coin* coin) const
+{
+    StagedMap::iterator it = mapStaged.find(outpoint);
+    if (it != mapStaged.end()) {
+        nStagedUsage -= StagedUsage(it->second);
+        if (coin)
+            *coin = std::move(it->second);
+        mapStaged.erase(it);
+        return true;
+    }
+    it = mapStagedOld.find(outpoint);
+    if (it != mapStagedOld.end()) {
+        nStagedUsageOld -= StagedUsage(it->second);
+        if (coin)
+            *coin = std::move(it->second);
+        mapStagedOld.erase(it);
+        return true;
+    }
+    return false;
+}
+
+void CCoinsViewPrefetch::Stage(const COutPoint &outpoint, Coin&& coin)
+{
+    if (mapStagedOld.count(outpoint))
+        return;
+    size_t nUsage = StagedUsage(coin);
+    if (!mapStaged.insert(std::make_pair(outpoint, std::move(coin))).second)
+        return;
+    nStagedUsage += nUsage;
+    if (nStagedUsage > nMaxUsage / 2) {
+        // Start a new generation, dropping the coins staged before the current one.
+        mapStagedOld.clear();
+        mapStagedOld.swap(mapStaged);
+        nStagedUsageOld = nStagedUsage;
+        nStagedUsage = 0;
+    }
+}
+
+bool CCoinsViewPrefetch::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (Unstage(outpoint, &coin))
+            return true;
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewPrefetch::HaveCoin(const COutPoint &outpoint) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (mapStaged.count(outpoint) || mapStagedOld.count(outpoint))
+            return true;
+    }
+    return base->HaveCoin(outpoint);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nWriteSequence++;
+        // Drop the staged coins this write supersedes, looking up whichever side is smaller.
+        if (mapStaged.size() + mapStagedOld.size() < mapCoins.size()) {
+            for (int i = 0; i < 2; i++) {
+                StagedMap& map = i ? mapStagedOld : mapStaged;
+                for (StagedMap::iterator it = map.begin(); it != map.end(); ) {
+                    CCoinsMap::const_iterator itCoins = mapCoins.find(it->first);
+                    if (itCoins != mapCoins.end() && (itCoins->second.flags & CCoinsCacheEntry::DIRTY)) {
+                        (i ? nStagedUsageOld : nStagedUsage) -= StagedUsage(it->second);
+                        it = map.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+        } else if (!mapStaged.empty() || !mapStagedOld.empty()) {
+            for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+                if (it->second.flags & CCoinsCacheEntry::DIRTY)
+                    Unstage(it->first, NULL);
+            }
+        }
+    }
+    bool fOk = base->BatchWrite(mapCoins, hashBlock);
+    {
+        // Reads that started while the base view was being written may have
+        // seen either state of it.
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nWriteSequence++;
+    }
+    return fOk;
+}
+
+void CCoinsViewPrefetch::Prefetch(const CBlock& block, const CCoinsViewCache& cache)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // Don't queue more reads than could be staged before the first of them are dropped.
+        if (nWorkers == 0 || nQueued * StagedUsage(Coin()) > nMaxUsage / 2)
+            return;
+    }
+
+    std::set<uint256> setBlockTxids;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        setBlockTxids.insert(tx.GetHash());
+
+    std::vector<std::vector<COutPoint> > vBatches;
+    size_t nOutPoints = 0;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (setBlockTxids.count(txin.prevout.hash) || cache.HaveCoinInCache(txin.prevout))
+                continue;
+            if (vBatches.empty() || vBatches.back().size() == PREFETCH_BATCH_SIZE) {
+                vBatches.push_back(std::vector<COutPoint>());
+                vBatches.back().reserve(PREFETCH_BATCH_SIZE);
+            }
+            vBatches.back().push_back(txin.prevout);
+            nOutPoints++;
+        }
+    }
+    if (vBatches.empty())
+        return;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (size_t i = 0; i < vBatches.size(); i++) {
+        queue.push_back(std::vector<COutPoint>());
+        queue.back().swap(vBatches[i]);
+    }
+    nQueued += nOutPoints;
+    condWorker.notify_all();
+}
+
+void CCoinsViewPrefetch::ThreadPrefetch()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nWorkers++;
+    }
+    std::vector<COutPoint> vBatch;
+    std::vector<std::pair<COutPoint, Coin> > vRead;
+    while (true) {
+        uint64_t nSequence;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queue.empty())
+                condWorker.wait(lock);
+            vBatch.swap(queue.front());
+            queue.pop_front();
+            nSequence = nWriteSequence;
+        }
+
+        vRead.clear();
+        BOOST_FOREACH(const COutPoint& outpoint, vBatch) {
+            Coin coin;
+            try {
+                if (base->GetCoin(outpoint, coin))
+                    vRead.push_back(std::make_pair(outpoint, std::move(coin)));
+            } catch (const std::exception& e) {
+                // The read will be retried by the validation thread, which reports the error.
+                LogPrint("coindb", "%s: %s\n", __func__, e.what());
+            }
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // An odd sequence means the batch was taken while a write was in
+        // progress, and the reads may have seen the base view half written.
+        if (nSequence == nWriteSequence && !(nSequence & 1)) {
+            for (size_t i = 0; i < vRead.size(); i++)
+                Stage(vRead[i].first, std::move(vRead[i].second));
+        }
+        nQueued -= vBatch.size();
+        vBatch.clear();
+    }
+}
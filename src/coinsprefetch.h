@@ -0,0 +1,91 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "coins.h"
+
+#include <deque>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+class CBlock;
+
+/** -prefetchthreads default */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of coin prefetch threads */
+static const int MAX_PREFETCH_THREADS = 16;
+
+/**
+ * CCoinsView that reads the inputs of blocks from its base view on a pool of
+ * worker threads, ahead of the block being connected.
+ *
+ * It sits between the coins cache and the database. Prefetch() queues the
+ * outpoints a block spends; the workers read them from the base view and
+ * stage what they find, so that the cache misses of ConnectBlock are served
+ * from memory instead of by one database read after another. A staged coin
+ * is handed out (and forgotten) by the first GetCoin for it.
+ *
+ * Staged coins are only valid while the base view is unchanged: BatchWrite
+ * drops the staged coins it writes, and the reads in progress while it runs.
+ * Memory is bounded by keeping two generations of staged coins and dropping
+ * the older one when the newer one is full, so coins staged for blocks that
+ * are never connected age out.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    typedef boost::unordered_map<COutPoint, Coin, SaltedOutpointHasher> StagedMap;
+
+    //! Outpoints read per job, so that the reads of one block are spread over the workers
+    static const size_t PREFETCH_BATCH_SIZE = 64;
+
+    mutable boost::mutex mutex;
+    boost::condition_variable condWorker;
+
+    //! Batches of outpoints waiting to be read
+    std::deque<std::vector<COutPoint> > queue;
+    //! Outpoints queued or being read
+    size_t nQueued;
+
+    //! Staged coins of the current generation and the one before, and their memory usage
+    mutable StagedMap mapStaged;
+    mutable StagedMap mapStagedOld;
+    mutable size_t nStagedUsage;
+    mutable size_t nStagedUsageOld;
+    size_t nMaxUsage;
+
+    //! Bumped by BatchWrite before and after writing the base view, so it is
+    //! odd while a write is in progress. Reads that overlap a write are dropped.
+    uint64_t nWriteSequence;
+
+    //! Number of running worker threads; nothing is queued without one
+    int nWorkers;
+
+    static size_t StagedUsage(const Coin& coin);
+    bool Unstage(const COutPoint &outpoint, Coin* coin) const;
+    void Stage(const COutPoint &outpoint, Coin&& coin);
+
+public:
+    CCoinsViewPrefetch(CCoinsView *viewIn, size_t nMaxUsageIn);
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    /**
+     * Queue the coins spent by a block for reading. Inputs that spend outputs
+     * of the block itself, or that cache already holds, are skipped.
+     */
+    void Prefetch(const CBlock& block, const CCoinsViewCache& cache);
+
+    //! Worker thread loop, run by each of the -prefetchthreads threads
+    void ThreadPrefetch();
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
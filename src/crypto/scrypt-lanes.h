@@ -0,0 +1,133 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+/*
+ * Multi-lane scrypt core: SCRYPT_LANES independent inputs are hashed at once,
+ * with word k of every lane packed into one vector. This file has no include
+ * guard on purpose. Each backend translation unit includes its dependencies,
+ * selects its target ISA, defines SCRYPT_LANES and then includes this file,
+ * getting its own internal-linkage copy of the code compiled for that ISA.
+ */
+
+#ifndef SCRYPT_LANES
+#error "SCRYPT_LANES must be defined before including scrypt-lanes.h"
+#endif
+
+namespace {
+
+typedef uint32_t scrypt_lane_vec __attribute__((vector_size(4 * SCRYPT_LANES)));
+
+#define LANE_ROTL(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+inline void xor_salsa8_lanes(scrypt_lane_vec B[16], const scrypt_lane_vec Bx[16])
+{
+	scrypt_lane_vec x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = (B[i] ^= Bx[i]);
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		x[ 4] ^= LANE_ROTL(x[ 0] + x[12],  7);  x[ 9] ^= LANE_ROTL(x[ 5] + x[ 1],  7);
+		x[14] ^= LANE_ROTL(x[10] + x[ 6],  7);  x[ 3] ^= LANE_ROTL(x[15] + x[11],  7);
+
+		x[ 8] ^= LANE_ROTL(x[ 4] + x[ 0],  9);  x[13] ^= LANE_ROTL(x[ 9] + x[ 5],  9);
+		x[ 2] ^= LANE_ROTL(x[14] + x[10],  9);  x[ 7] ^= LANE_ROTL(x[ 3] + x[15],  9);
+
+		x[12] ^= LANE_ROTL(x[ 8] + x[ 4], 13);  x[ 1] ^= LANE_ROTL(x[13] + x[ 9], 13);
+		x[ 6] ^= LANE_ROTL(x[ 2] + x[14], 13);  x[11] ^= LANE_ROTL(x[ 7] + x[ 3], 13);
+
+		x[ 0] ^= LANE_ROTL(x[12] + x[ 8], 18);  x[ 5] ^= LANE_ROTL(x[ 1] + x[13], 18);
+		x[10] ^= LANE_ROTL(x[ 6] + x[ 2], 18);  x[15] ^= LANE_ROTL(x[11] + x[ 7], 18);
+
+		/* Operate on rows. */
+		x[ 1] ^= LANE_ROTL(x[ 0] + x[ 3],  7);  x[ 6] ^= LANE_ROTL(x[ 5] + x[ 4],  7);
+		x[11] ^= LANE_ROTL(x[10] + x[ 9],  7);  x[12] ^= LANE_ROTL(x[15] + x[14],  7);
+
+		x[ 2] ^= LANE_ROTL(x[ 1] + x[ 0],  9);  x[ 7] ^= LANE_ROTL(x[ 6] + x[ 5],  9);
+		x[ 8] ^= LANE_ROTL(x[11] + x[10],  9);  x[13] ^= LANE_ROTL(x[12] + x[15],  9);
+
+		x[ 3] ^= LANE_ROTL(x[ 2] + x[ 1], 13);  x[ 4] ^= LANE_ROTL(x[ 7] + x[ 6], 13);
+		x[ 9] ^= LANE_ROTL(x[ 8] + x[11], 13);  x[14] ^= LANE_ROTL(x[13] + x[12], 13);
+
+		x[ 0] ^= LANE_ROTL(x[ 3] + x[ 2], 18);  x[ 5] ^= LANE_ROTL(x[ 4] + x[ 7], 18);
+		x[10] ^= LANE_ROTL(x[ 9] + x[ 8], 18);  x[15] ^= LANE_ROTL(x[14] + x[13], 18);
+	}
+	for (i = 0; i < 16; i++)
+		B[i] += x[i];
+}
+
+#undef LANE_ROTL
+
+/* input: SCRYPT_LANES * 80 bytes, output: SCRYPT_LANES * 32 bytes */
+void scrypt_1024_1_1_256_sp_lanes(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[SCRYPT_LANES][128];
+	scrypt_lane_vec X[32];
+	scrypt_lane_vec *V;
+	uint32_t i, k, l;
+	uint32_t j[SCRYPT_LANES];
+
+	V = (scrypt_lane_vec *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (l = 0; l < SCRYPT_LANES; l++)
+		PBKDF2_SHA256((const uint8_t *)&input[80 * l], 80, (const uint8_t *)&input[80 * l], 80, 1, B[l], 128);
+
+	for (k = 0; k < 32; k++)
+		for (l = 0; l < SCRYPT_LANES; l++)
+			X[k][l] = le32dec(&B[l][4 * k]);
+
+	for (i = 0; i < 1024; i++) {
+		memcpy(&V[i * 32], X, sizeof(X));
+		xor_salsa8_lanes(&X[0], &X[16]);
+		xor_salsa8_lanes(&X[16], &X[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Every lane reads its own row of the scratchpad. */
+		for (l = 0; l < SCRYPT_LANES; l++)
+			j[l] = 32 * (X[16][l] & 1023);
+		for (k = 0; k < 32; k++) {
+			scrypt_lane_vec T;
+			for (l = 0; l < SCRYPT_LANES; l++)
+				T[l] = V[j[l] + k][l];
+			X[k] ^= T;
+		}
+		xor_salsa8_lanes(&X[0], &X[16]);
+		xor_salsa8_lanes(&X[16], &X[0]);
+	}
+
+	for (k = 0; k < 32; k++)
+		for (l = 0; l < SCRYPT_LANES; l++)
+			le32enc(&B[l][4 * k], X[k][l]);
+
+	for (l = 0; l < SCRYPT_LANES; l++)
+		PBKDF2_SHA256((const uint8_t *)&input[80 * l], 80, B[l], 128, 1, (uint8_t *)&output[32 * l], 32);
+}
+
+} // namespace
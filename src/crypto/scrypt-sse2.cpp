@@ -28,6 +28,8 @@
  */
 
 #include "crypto/scrypt.h"
+
+#if defined(USE_SSE2)
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -35,6 +37,11 @@
 
 #include <emmintrin.h>
 
+#if defined(__i386__) && !defined(__SSE2__)
+// Only reached through runtime detection on 32bit x86
+#pragma GCC target("sse2")
+#endif
+
 static inline void xor_salsa8_sse2(__m128i B[4], const __m128i Bx[4])
 {
 	__m128i X0, X1, X2, X3;
@@ -134,3 +141,14 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
+
+#if defined(USE_SCRYPT_LANES)
+#define SCRYPT_LANES 4
+#include "crypto/scrypt-lanes.h"
+
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad)
+{
+	scrypt_1024_1_1_256_sp_lanes(input, output, scratchpad);
+}
+#endif // USE_SCRYPT_LANES
+#endif // USE_SSE2
@@ -287,43 +287,93 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 }
 
 #if defined(USE_SSE2)
-// By default, set to generic scrypt function. This will prevent crash in case when scrypt_detect_sse2() wasn't called
+// By default, set to generic scrypt function. This will prevent crash in case when scrypt_detect_cpu() wasn't called
 void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic;
+#endif
+
+typedef void (*scrypt_lanes_fn)(const char *input, char *output, char *scratchpad);
+
+struct scrypt_lanes_backend {
+	size_t lanes;
+	scrypt_lanes_fn fn;
+};
+
+// Multi-lane backends usable on this CPU, widest first.
+static scrypt_lanes_backend scrypt_lanes_backends[4] = {
+#if defined(USE_SCRYPT_LANES) && defined(USE_SSE2_ALWAYS)
+	{ 4, &scrypt_1024_1_1_256_sp_sse2_4way },
+#endif
+	{ 0, NULL }
+};
 
-void scrypt_detect_sse2()
+const char *scrypt_detect_cpu()
 {
+#if defined(USE_SSE2)
+	bool fSSE2;
 #if defined(USE_SSE2_ALWAYS)
-    printf("scrypt: using scrypt-sse2 as built.\n");
+	fSSE2 = true;
 #else // USE_SSE2_ALWAYS
-    // 32bit x86 Linux or Windows, detect cpuid features
-    unsigned int cpuid_edx=0;
+	// 32bit x86 Linux or Windows, detect cpuid features
+	unsigned int cpuid_edx=0;
 #if defined(_MSC_VER)
-    // MSVC
-    int x86cpuid[4];
-    __cpuid(x86cpuid, 1);
-    cpuid_edx = (unsigned int)buffer[3];
+	// MSVC
+	int x86cpuid[4];
+	__cpuid(x86cpuid, 1);
+	cpuid_edx = (unsigned int)x86cpuid[3];
 #else // _MSC_VER
-    // Linux or i686-w64-mingw32 (gcc-4.6.3)
-    unsigned int eax, ebx, ecx;
-    __get_cpuid(1, &eax, &ebx, &ecx, &cpuid_edx);
+	// Linux or i686-w64-mingw32 (gcc-4.6.3)
+	unsigned int eax, ebx, ecx;
+	__get_cpuid(1, &eax, &ebx, &ecx, &cpuid_edx);
 #endif // _MSC_VER
-
-    if (cpuid_edx & 1<<26)
-    {
-        scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_sse2;
-        printf("scrypt: using scrypt-sse2 as detected.\n");
-    }
-    else
-    {
-        scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_generic;
-        printf("scrypt: using scrypt-generic, SSE2 unavailable.\n");
-    }
+	fSSE2 = (cpuid_edx & 1<<26) != 0;
+	scrypt_1024_1_1_256_sp_detected = fSSE2 ? &scrypt_1024_1_1_256_sp_sse2 : &scrypt_1024_1_1_256_sp_generic;
 #endif // USE_SSE2_ALWAYS
+
+#if defined(USE_SCRYPT_LANES)
+	int n = 0;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		scrypt_lanes_backends[n++] = { 16, &scrypt_1024_1_1_256_sp_avx512_16way };
+	if (__builtin_cpu_supports("avx2"))
+		scrypt_lanes_backends[n++] = { 8, &scrypt_1024_1_1_256_sp_avx2_8way };
+	if (fSSE2)
+		scrypt_lanes_backends[n++] = { 4, &scrypt_1024_1_1_256_sp_sse2_4way };
+	scrypt_lanes_backends[n] = { 0, NULL };
+
+	switch (scrypt_lanes_backends[0].lanes) {
+	case 16: return "sse2, avx512 16-way batch";
+	case 8:  return "sse2, avx2 8-way batch";
+	case 4:  return "sse2, sse2 4-way batch";
+	}
+#endif // USE_SCRYPT_LANES
+	return fSSE2 ? "sse2" : "generic";
+#else
+	return "generic";
+#endif // USE_SSE2
 }
-#endif
 
 void scrypt_1024_1_1_256(const char *input, char *output)
 {
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+void scrypt_1024_1_1_256_batch(const char *input, char *output, size_t count)
+{
+	size_t i = 0;
+	char *scratchpad = NULL;
+
+	for (const scrypt_lanes_backend *b = scrypt_lanes_backends; b->lanes != 0 && i < count; b++) {
+		if (count - i < b->lanes)
+			continue;
+		// Backends are ordered widest first, so the first scratchpad allocated fits all later ones.
+		if (scratchpad == NULL && (scratchpad = (char *)malloc(SCRYPT_LANES_SCRATCHPAD_SIZE(b->lanes))) == NULL)
+			break;
+		for (; count - i >= b->lanes; i += b->lanes)
+			b->fn(&input[80 * i], &output[32 * i], scratchpad);
+	}
+	free(scratchpad);
+
+	for (; i < count; i++)
+		scrypt_1024_1_1_256(&input[80 * i], &output[32 * i]);
+}
@@ -5,9 +5,26 @@
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/** Scratchpad needed to hash `lanes` inputs at once with the multi-lane backends. */
+#define SCRYPT_LANES_SCRATCHPAD_SIZE(lanes) (131072 * (lanes) + 63)
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/**
+ * Hash `count` 80-byte inputs stored back to back in `input`, writing `count`
+ * 32-byte digests to `output`. Groups of inputs are processed in interleaved
+ * SIMD lanes when the CPU supports it, the remainder one at a time.
+ */
+void scrypt_1024_1_1_256_batch(const char *input, char *output, size_t count);
+
+/** Pick the fastest scrypt backends for this CPU. Returns a description for the log. */
+const char *scrypt_detect_cpu();
+
+#if !defined(USE_SSE2) && (defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64) || defined(__i386__) || defined(_M_IX86))
+#define USE_SSE2 1
+#endif
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
@@ -16,9 +33,17 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_detected((input), (output), (scratchpad))
 #endif
 
-void scrypt_detect_sse2();
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad);
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+// Multi-lane backends: each call hashes N consecutive 80-byte inputs using a
+// scratchpad of SCRYPT_LANES_SCRATCHPAD_SIZE(N) bytes.
+#define USE_SCRYPT_LANES 1
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad);
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad);
+void scrypt_1024_1_1_256_sp_avx512_16way(const char *input, char *output, char *scratchpad);
+#endif
 #else
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
@@ -0,0 +1,200 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include "uint256.h"
+
+#include <atomic>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fixed-size set of uniformly distributed 256-bit entries (salted hashes),
+ * shared between threads.
+ *
+ * The table is an array of buckets of SLOTS_PER_BUCKET entries, each bucket
+ * aligned to a cache line. As in cuckoo hashing, an entry lives in one of two
+ * buckets picked from its own bits, but entries are never displaced: when
+ * both buckets of a new entry are full, it replaces a slot chosen by its
+ * bits, so eviction is O(1) and memory use never changes after construction.
+ *
+ * Every bucket is a seqlock. Lookups take no lock; they read the bucket and
+ * retry if a writer changed it meanwhile. Writers (insert and erase) only
+ * lock the one bucket they modify.
+ *
+ * A lookup never reports an entry that was not inserted: entries are
+ * compared in full. A slot of all zeroes is empty.
+ */
+class CCuckooCache
+{
+public:
+    static const int SLOTS_PER_BUCKET = 3;
+
+private:
+    struct Bucket {
+        //! Odd while a writer holds the bucket, bumped by every write
+        std::atomic<uint32_t> nSequence;
+        std::atomic<uint64_t> slots[SLOTS_PER_BUCKET][4];
+    };
+    static const size_t BUCKET_SIZE = (sizeof(Bucket) + 63) & ~(size_t)63;
+
+    char* pAlloc;
+    char* pTable;
+    uint32_t nBuckets;
+
+    CCuckooCache(const CCuckooCache&);
+    CCuckooCache& operator=(const CCuckooCache&);
+
+    Bucket& GetBucket(uint32_t nHash) const
+    {
+        return *reinterpret_cast<Bucket*>(pTable + (((uint64_t)nHash * nBuckets) >> 32) * BUCKET_SIZE);
+    }
+
+    static bool SlotEquals(const Bucket& bucket, int nSlot, const uint64_t (&words)[4])
+    {
+        for (int i = 0; i < 4; i++)
+            if (bucket.slots[nSlot][i].load(std::memory_order_relaxed) != words[i])
+                return false;
+        return true;
+    }
+
+    static bool SlotEmpty(const Bucket& bucket, int nSlot)
+    {
+        static const uint64_t zero[4] = {0, 0, 0, 0};
+        return SlotEquals(bucket, nSlot, zero);
+    }
+
+    static void SlotStore(Bucket& bucket, int nSlot, const uint64_t (&words)[4])
+    {
+        for (int i = 0; i < 4; i++)
+            bucket.slots[nSlot][i].store(words[i], std::memory_order_relaxed);
+    }
+
+    /** Find the slot holding words in bucket without locking it, or -1 */
+    static int Find(const Bucket& bucket, const uint64_t (&words)[4])
+    {
+        while (true) {
+            uint32_t nSeq = bucket.nSequence.load(std::memory_order_acquire);
+            if (nSeq & 1)
+                continue;
+            int nFound = -1;
+            for (int i = 0; i < SLOTS_PER_BUCKET && nFound < 0; i++)
+                if (SlotEquals(bucket, i, words))
+                    nFound = i;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (bucket.nSequence.load(std::memory_order_relaxed) == nSeq)
+                return nFound;
+        }
+    }
+
+    static uint32_t Lock(Bucket& bucket)
+    {
+        while (true) {
+            uint32_t nSeq = bucket.nSequence.load(std::memory_order_relaxed);
+            if (!(nSeq & 1) && bucket.nSequence.compare_exchange_weak(nSeq, nSeq + 1, std::memory_order_acquire)) {
+                std::atomic_thread_fence(std::memory_order_release);
+                return nSeq;
+            }
+        }
+    }
+
+    static void Unlock(Bucket& bucket, uint32_t nSeq)
+    {
+        bucket.nSequence.store(nSeq + 2, std::memory_order_release);
+    }
+
+    static void ToWords(const uint256& entry, uint64_t (&words)[4])
+    {
+        for (int i = 0; i < 4; i++)
+            words[i] = entry.GetUint64(i);
+    }
+
+public:
+    /** Create a cache using at most nBytes of memory */
+    explicit CCuckooCache(size_t nBytes) : pAlloc(NULL), pTable(NULL), nBuckets(0)
+    {
+        size_t n = nBytes / BUCKET_SIZE;
+        nBuckets = n > UINT32_MAX ? UINT32_MAX : n;
+        if (nBuckets == 0)
+            return;
+        pAlloc = new char[(size_t)nBuckets * BUCKET_SIZE + 63];
+        pTable = pAlloc + ((64 - ((uintptr_t)pAlloc & 63)) & 63);
+        for (uint32_t i = 0; i < nBuckets; i++) {
+            Bucket* bucket = new (pTable + (size_t)i * BUCKET_SIZE) Bucket;
+            bucket->nSequence.store(0, std::memory_order_relaxed);
+            for (int j = 0; j < SLOTS_PER_BUCKET; j++)
+                for (int k = 0; k < 4; k++)
+                    bucket->slots[j][k].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~CCuckooCache()
+    {
+        for (uint32_t i = 0; i < nBuckets; i++)
+            reinterpret_cast<Bucket*>(pTable + (size_t)i * BUCKET_SIZE)->~Bucket();
+        delete[] pAlloc;
+    }
+
+    /** Whether entry is in the cache. With fErase, remove it as well. */
+    bool contains(const uint256& entry, bool fErase)
+    {
+        if (nBuckets == 0)
+            return false;
+        uint64_t words[4];
+        ToWords(entry, words);
+        Bucket* buckets[2] = {&GetBucket(words[0]), &GetBucket(words[0] >> 32)};
+        for (int b = 0; b < 2; b++) {
+            if (Find(*buckets[b], words) < 0)
+                continue;
+            if (fErase) {
+                uint32_t nSeq = Lock(*buckets[b]);
+                for (int i = 0; i < SLOTS_PER_BUCKET; i++) {
+                    if (SlotEquals(*buckets[b], i, words)) {
+                        static const uint64_t zero[4] = {0, 0, 0, 0};
+                        SlotStore(*buckets[b], i, zero);
+                    }
+                }
+                Unlock(*buckets[b], nSeq);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void insert(const uint256& entry)
+    {
+        if (nBuckets == 0)
+            return;
+        uint64_t words[4];
+        ToWords(entry, words);
+        Bucket* buckets[2] = {&GetBucket(words[0]), &GetBucket(words[0] >> 32)};
+        if (Find(*buckets[0], words) >= 0 || Find(*buckets[1], words) >= 0)
+            return;
+        for (int b = 0; b < 2; b++) {
+            uint32_t nSeq = Lock(*buckets[b]);
+            for (int i = 0; i < SLOTS_PER_BUCKET; i++) {
+                if (SlotEmpty(*buckets[b], i)) {
+                    SlotStore(*buckets[b], i, words);
+                    Unlock(*buckets[b], nSeq);
+                    return;
+                }
+            }
+            Unlock(*buckets[b], nSeq);
+        }
+        // Both buckets are full: replace an entry picked by the bits of this one.
+        int nVictim = words[1] % (2 * SLOTS_PER_BUCKET);
+        Bucket& bucket = *buckets[nVictim / SLOTS_PER_BUCKET];
+        uint32_t nSeq = Lock(bucket);
+        SlotStore(bucket, nVictim % SLOTS_PER_BUCKET, words);
+        Unlock(bucket, nSeq);
+    }
+
+    //! Number of entries the cache can hold
+    size_t capacity() const { return (size_t)nBuckets * SLOTS_PER_BUCKET; }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
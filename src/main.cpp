@@ -10,12 +10,16 @@
 #include "addrman.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "blockfilemap.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "core_memusage.h"
+#include "cuckoocache.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -80,7 +84,10 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fMapBlockFiles = DEFAULT_MAPBLOCKFILES;
+uint256 hashAssumeValid;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nRecentBlockCacheUsage = DEFAULT_RECENT_BLOCK_CACHE << 20;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -90,7 +97,6 @@ int AlgoForkHeight = 1250000;
 bool AlgoSwitch = false;
 double LastBlocks = -1;
 double ClientUptime = -1;
-int WarpSync = 64;
 
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
 CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
@@ -122,6 +128,8 @@ void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
  */
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams);
 static void CheckBlockIndex(const Consensus::Params& consensusParams);
+/** Script verification flags the block at pindex is validated with */
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -240,11 +248,98 @@ namespace {
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** A transaction in the relay map, with its "tx" payloads (without and with witness) once requested. */
+    struct CRelayedTx {
+        std::shared_ptr<const CTransaction> tx;
+        CNetPayloadRef payload[2];
+
+        explicit CRelayedTx(std::shared_ptr<const CTransaction>&& txIn) : tx(std::move(txIn)) {}
+    };
+
     /** Relay map, protected by cs_main. */
-    typedef std::map<uint256, std::shared_ptr<const CTransaction>> MapRelay;
+    typedef std::map<uint256, CRelayedTx> MapRelay;
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** Block of the last cmpctblock announcement, and its payloads without and with witnesses, protected by cs_main. */
+    uint256 hashAnnouncedCmpctBlock;
+    CNetPayloadRef vAnnouncedCmpctBlock[2];
+
+    /**
+     * The most recently connected blocks and their "block" payloads (without
+     * and with witnesses), so that getdata for blocks near the tip is answered
+     * without reading the block from disk and serializing it once per peer.
+     * Least recently used entries are evicted first. Protected by cs_main.
+     */
+    class CRecentBlockCache
+    {
+    public:
+        struct Entry {
+            std::shared_ptr<const CBlock> block;
+            CNetPayloadRef payload[2];
+            size_t nUsage;
+        };
+
+    private:
+        typedef std::list<std::pair<uint256, Entry> > EntryList;
+        EntryList entries;
+        std::map<uint256, EntryList::iterator> mapEntries;
+        size_t nUsage = 0;
+
+        void EvictTo(size_t nMaxUsage)
+        {
+            while (nUsage > nMaxUsage && !entries.empty()) {
+                nUsage -= entries.back().second.nUsage;
+                mapEntries.erase(entries.back().first);
+                entries.pop_back();
+            }
+        }
+
+    public:
+        void Add(const uint256& hash, const CBlock& block, size_t nMaxUsage)
+        {
+            if (mapEntries.count(hash))
+                return;
+            bool fHasWitness = false;
+            BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+                if (!tx.wit.IsNull()) {
+                    fHasWitness = true;
+                    break;
+                }
+            }
+            Entry entry;
+            entry.block = std::make_shared<const CBlock>(block);
+            entry.payload[0] = CNetPayload::Make(NetMsgType::BLOCK, SERIALIZE_TRANSACTION_NO_WITNESS, block);
+            // Without witnesses both encodings are the same bytes
+            entry.payload[1] = fHasWitness ? CNetPayload::Make(NetMsgType::BLOCK, 0, block) : entry.payload[0];
+            entry.nUsage = RecursiveDynamicUsage(block) + entry.payload[0]->vData.size() + (fHasWitness ? entry.payload[1]->vData.size() : 0);
+            if (entry.nUsage > nMaxUsage)
+                return;
+            EvictTo(nMaxUsage - entry.nUsage);
+            nUsage += entry.nUsage;
+            entries.emplace_front(hash, std::move(entry));
+            mapEntries[hash] = entries.begin();
+        }
+
+        /** Look up a block, marking it as most recently used. Returns NULL if it is not cached. */
+        const Entry* Get(const uint256& hash)
+        {
+            std::map<uint256, EntryList::iterator>::iterator it = mapEntries.find(hash);
+            if (it == mapEntries.end())
+                return NULL;
+            entries.splice(entries.begin(), entries, it->second);
+            return &it->second->second;
+        }
+
+        void Clear()
+        {
+            entries.clear();
+            mapEntries.clear();
+            nUsage = 0;
+        }
+    };
+    CRecentBlockCache recentBlockCache;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -706,6 +801,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewPrefetch *pcoinsPrefetch = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -989,15 +1085,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if ((unsigned int)coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -1138,9 +1234,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -1155,7 +1251,7 @@ std::string FormatStateMessage(const CValidationState &state)
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
                               bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+                              std::vector<COutPoint>& vCoinsToUncache)
 {
  std::string forbidtx[1495]={"465e9dfb27","61f9018c6b","405eb50c1f","63d25ed869","e485c52f14","b09c9c4e42","8f34cd33fe","f323a23887",
 		"20bf7f06d3","237d8a4bae","79ce6dfec6","58bff431eb","eb72817e34","03847f0174","ed91cd6fb0","407776c21c","c5c830e983","e9a9303d70",
@@ -1419,31 +1515,24 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
-        }
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                vCoinsToUncache.push_back(txin.prevout);
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
 
-        // are the actual inputs available?
-        if (!view.HaveInputs(tx))
-            return state.Invalid(false, REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
         // Bring the best block into scope
         view.GetBestBlock();
 
@@ -1485,8 +1574,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1702,20 +1791,20 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
+        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
-            if (tx.wit.IsNull() && CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, txdata) &&
-                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, txdata)) {
+            if (tx.wit.IsNull() && CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
+                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
                 // Only the witness is missing, so the transaction itself may be fine.
                 state.SetCorruptionPossible();
             }
             return false;
         }
 
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
+        // Check again against the consensus-critical flags the current tip
+        // was validated with, in case of bugs in the standard flags that cause
         // transactions to pass as valid when they're actually invalid. For
         // instance the STRICTENC flag was incorrectly allowing certain
         // CHECKSIG NOT scripts to pass, even though they were invalid.
@@ -1723,7 +1812,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
+        //
+        // The result is cached, so that a block including the transaction
+        // under the same flags does not execute its scripts again.
+        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus()) | MANDATORY_SCRIPT_VERIFY_FLAGS;
+        if (!CheckInputs(tx, state, view, true, currentBlockScriptVerifyFlags, true, true, txdata))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
@@ -1759,11 +1852,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> vCoinsToUncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vCoinsToUncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
-            pcoinsTip->Uncache(hashTx);
+        BOOST_FOREACH(const COutPoint& outpoint, vCoinsToUncache)
+            pcoinsTip->Uncache(outpoint);
     }
     return res;
 }
@@ -1806,10 +1899,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1862,10 +1954,48 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+/** Mappings of finalized block and undo files, used with -mmapblocks */
+static CBlockFileMap blockfilemap;
+
+/**
+ * With -mmapblocks, return the mapping of the block (or undo) file holding
+ * pos, or NULL if it has to be read through OpenDiskFile. The file currently
+ * written to is never mapped, as it is still truncated when finalized.
+ */
+static std::shared_ptr<const CMappedFile> GetMappedBlockFile(const CDiskBlockPos& pos, bool fUndo)
+{
+    if (!fMapBlockFiles)
+        return std::shared_ptr<const CMappedFile>();
+    size_t nUsed;
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile < 0 || pos.nFile >= nLastBlockFile)
+            return std::shared_ptr<const CMappedFile>();
+        nUsed = fUndo ? vinfoBlockFile[pos.nFile].nUndoSize : vinfoBlockFile[pos.nFile].nSize;
+    }
+    std::shared_ptr<const CMappedFile> mapped = blockfilemap.Get(fUndo ? "rev" : "blk", pos.nFile, nUsed);
+    if (mapped && pos.nPos >= mapped->size())
+        return std::shared_ptr<const CMappedFile>();
+    return mapped;
+}
+
+static bool ReadBlockFromDiskNoPoW(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
+    // Deserialize straight from the mapping if the file is mapped
+    std::shared_ptr<const CMappedFile> mapped = GetMappedBlockFile(pos, false);
+    if (mapped) {
+        try {
+            CMemoryReader filein(mapped->begin() + pos.nPos, mapped->end(), SER_DISK, CLIENT_VERSION);
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1878,56 +2008,98 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
-    
-    // WarpSync check every 1/32th blocks pow hash (baz)
-    int syncheight = GetHeight();
-    if (syncheight > 1112500) { WarpSync=1; }
-    if (syncheight % WarpSync == 0) {
-        // Check proof of work matches claimed amount
-        if (!CheckProofOfWork(block.GetPoWHash(AlgoSwitch), block.nBits, consensusParams, true)){
-            if(WarpSync!=1){ LogPrintf("** HALTNG WarpSync DUE TO ERRORS ENCOUNTERED\n"); }
-            //if(AlgoSwitch){
-                //LogPrintf("** FAILED ON BALLOON (unrecoverable)\n");
-                //return error("ReadBlockFromDisk: Errors in block header at %s (balloon pow)", pos.ToString());
+    return true;
+}
+
+static bool CheckDiskBlockPoW(const CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    // Check proof of work matches claimed amount
+    if (!CheckProofOfWork(block.GetPoWHash(AlgoSwitch), block.nBits, consensusParams, true)){
+        //if(AlgoSwitch){
+            //LogPrintf("** FAILED ON BALLOON (unrecoverable)\n");
+            //return error("ReadBlockFromDisk: Errors in block header at %s (balloon pow)", pos.ToString());
+        //} else {
+            // could be failed balloon block
+            //if (!CheckProofOfWork(block.GetPoWHash(true), block.nBits, consensusParams, false)){
+                LogPrintf("** FAILED ON SCRYPT\n");
+                return error("ReadBlockFromDisk: Errors in block header at %s (scrypt pow)", pos.ToString());
             //} else {
-                // could be failed balloon block
-                //if (!CheckProofOfWork(block.GetPoWHash(true), block.nBits, consensusParams, false)){
-                    LogPrintf("** FAILED ON SCRYPT\n");
-                    return error("ReadBlockFromDisk: Errors in block header at %s (scrypt pow)", pos.ToString());
-                //} else {
-                    //LogPrintf("** ALGO SWITCHED TO BALLOON\n");
-                    //AlgoSwitch=true;
-                //}
-	        //}
-        }
+                //LogPrintf("** ALGO SWITCHED TO BALLOON\n");
+                //AlgoSwitch=true;
+            //}
+        //}
     }
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadBlockFromDiskNoPoW(block, pos))
+        return false;
+    return CheckDiskBlockPoW(block, pos, consensusParams);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    if (!ReadBlockFromDiskNoPoW(block, pindex->GetBlockPos()))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
-    return true;
+    // The header hash ties the block to an index entry whose PoW was already
+    // verified when it was accepted, so the scrypt hash need not be redone.
+    if (pindex->nStatus & BLOCK_POW_CHECKED)
+        return true;
+    return CheckDiskBlockPoW(block, pindex->GetBlockPos(), consensusParams);
+}
+
+uint32_t CLazyMT19937::Word(int i)
+{
+    while (nSeeded <= i) {
+        x[nSeeded] = 1812433253UL * (x[nSeeded - 1] ^ (x[nSeeded - 1] >> 30)) + nSeeded;
+        nSeeded++;
+    }
+    return x[i];
+}
+
+CLazyMT19937::result_type CLazyMT19937::operator()()
+{
+    const int k = nDrawn++;
+    uint32_t z;
+    if (k < N - M) {
+        uint32_t y = (Word(k) & 0x80000000UL) | (Word(k + 1) & 0x7fffffffUL);
+        z = Word(k + M) ^ (y >> 1) ^ ((Word(k + 1) & 1) * 0x9908b0dfUL);
+    } else {
+        // Never reached in practice; defer to the full engine.
+        boost::random::mt19937 gen(x[0]);
+        gen.discard(k);
+        return gen();
+    }
+    z ^= (z >> 11);
+    z ^= (z << 7) & 0x9d2c5680UL;
+    z ^= (z << 15) & 0xefc60000UL;
+    z ^= (z >> 18);
+    return z;
 }
 
 int static generateMTRandom(unsigned int s, int range)
 {
-    boost::random::mt19937 gen(s);
+    CLazyMT19937 gen(s);
     boost::uniform_int<> dist(1, range);
     return dist(gen);
 }
 
+unsigned int GetSubsidySeed(const uint256& prevHash)
+{
+    const unsigned char* p = prevHash.begin();
+    return ((unsigned int)(p[28] & 0x0f) << 24) | ((unsigned int)p[27] << 16) | ((unsigned int)p[26] << 8) | p[25];
+}
+
 CAmount GetBlockSubsidy(int nHeight, uint256 prevHash)
 {
     CAmount nSubsidy = 29531 * COIN; // the lunar cycle is 29.53059 days, so we rounded it up
 
-    std::string cseed_str = prevHash.ToString().substr(7,7);
-    const char* cseed = cseed_str.c_str();
-    long seed = hex2long(cseed);
+    unsigned int seed = GetSubsidySeed(prevHash);
 
 	// cases for block 1 - 384400
 	if(nHeight <= 100000) {
@@ -2165,24 +2337,15 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            Coin coin;
+            bool fSpent = inputs.SpendCoin(txin.prevout, &coin);
+            assert(fSpent && !coin.IsSpent());
+            txundo.vprevout.push_back(CTxInUndo(coin.out, coin.fCoinBase, coin.nHeight));
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -2200,6 +2363,11 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CHeaderPoWCheck::operator()() {
+    GetPoWHashes(pheaders, phashes, nCount);
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2220,20 +2388,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - (int)coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - (int)coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -2253,7 +2421,53 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+namespace {
+
+/**
+ * Transactions whose scripts were all found valid under a set of script
+ * verification flags, so that connecting a block made of transactions that
+ * were accepted to the mempool does not execute their scripts again.
+ */
+class CScriptExecutionCache
+{
+private:
+    //! Entries are SHA256(nonce || wtxid || flags). The wtxid commits to the
+    //! spent outpoints, and with them to the spent outputs.
+    uint256 nonce;
+    CCuckooCache setValid;
+
+public:
+    CScriptExecutionCache() : setValid(GetSigCacheBytes())
+    {
+        // Half of -maxsigcachesize, the other half goes to the signature cache
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void ComputeEntry(uint256& entry, const CTransaction& tx, unsigned int flags) const
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(tx.GetWitnessHash().begin(), 32).Write((const unsigned char*)&flags, sizeof(flags)).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry, bool fErase)
+    {
+        return setValid.contains(entry, fErase);
+    }
+
+    void Set(const uint256& entry)
+    {
+        setValid.insert(entry);
+    }
+};
+
+CScriptExecutionCache& ScriptExecutionCache()
+{
+    static CScriptExecutionCache scriptExecutionCache;
+    return scriptExecutionCache;
+}
+
+} // anon namespace
+
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
@@ -2274,13 +2488,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // the checkpoint is for a chain that's invalid due to false scriptSigs
         // this optimization would allow an invalid chain to be accepted.
         if (fScriptChecks) {
+            // Skip the scripts of a transaction already verified with these
+            // flags. An entry is used up by the block that spends it.
+            uint256 hashCacheEntry;
+            ScriptExecutionCache().ComputeEntry(hashCacheEntry, tx, flags);
+            if (ScriptExecutionCache().Get(hashCacheEntry, !cacheFullScriptStore))
+                return true;
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheSigStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2292,8 +2513,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
+                        CScriptCheck check2(coin.out, tx, i,
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -2307,6 +2528,10 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            // Deferred checks have not run yet, so only results found here are cached.
+            if (cacheFullScriptStore && !pvChecks)
+                ScriptExecutionCache().Set(hashCacheEntry);
         }
     }
 
@@ -2344,19 +2569,32 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Read block
     uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    std::shared_ptr<const CMappedFile> mapped = GetMappedBlockFile(pos, true);
+    if (mapped) {
+        // Read block from the mapping
+        try {
+            CMemoryReader filein(mapped->begin() + pos.nPos, mapped->end(), SER_DISK, CLIENT_VERSION);
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenUndoFile failed", __func__);
+
+        // Read block
+        try {
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Verify checksum
@@ -2394,32 +2632,30 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
  * @param undo The undo object.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @param fClean Set to false if the undo data does not match the view.
+ * @return False if the output cannot be restored.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out, bool& fClean)
 {
-    bool fClean = true;
-
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
 
-    return fClean;
+    Coin coin(undo.txout, undo.nHeight, undo.fCoinBase);
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transaction's
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        coin.nHeight = alternate.nHeight;
+        coin.fCoinBase = alternate.fCoinBase;
+    }
+    // The overwrite flag may only be false if the coin is known not to exist,
+    // which HaveCoin told us above.
+    view.AddCoin(out, std::move(coin), !fClean);
+
+    return true;
 }
 
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
@@ -2448,21 +2684,14 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool fSpent = view.SpendCoin(out, &coin);
+                if (!fSpent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || tx.IsCoinBase() != (bool)coin.fCoinBase)
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+            }
         }
 
         // restore inputs
@@ -2473,8 +2702,8 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
                 const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
-                    fClean = false;
+                if (!ApplyTxInUndo(undo, view, out, fClean))
+                    return error("DisconnectBlock(): failed to restore input %s", out.ToString());
             }
         }
     }
@@ -2522,6 +2751,59 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Headers hashed per CHeaderPoWCheck; enough to fill the widest scrypt backend. */
+static const size_t HEADER_POW_CHECK_CHUNK = 16;
+
+static CCheckQueue<CHeaderPoWCheck> headercheckqueue(4);
+static CCriticalSection cs_headercheckqueue;
+
+void ThreadHeaderPoWCheck() {
+    RenameThread("mooncoin-hdrpow");
+    headercheckqueue.Thread();
+}
+
+/** Compute the PoW hashes of nCount headers, spread over the check threads if there are any. */
+static void HashHeadersPoW(const CBlockHeader* pheaders, uint256* phashes, size_t nCount)
+{
+    if (!nScriptCheckThreads) {
+        GetPoWHashes(pheaders, phashes, nCount);
+        return;
+    }
+
+    LOCK(cs_headercheckqueue);
+    CCheckQueueControl<CHeaderPoWCheck> control(&headercheckqueue);
+    std::vector<CHeaderPoWCheck> vChecks;
+    vChecks.reserve((nCount + HEADER_POW_CHECK_CHUNK - 1) / HEADER_POW_CHECK_CHUNK);
+    for (size_t i = 0; i < nCount; i += HEADER_POW_CHECK_CHUNK)
+        vChecks.push_back(CHeaderPoWCheck(&pheaders[i], &phashes[i], std::min(HEADER_POW_CHECK_CHUNK, nCount - i)));
+    control.Add(vChecks);
+    control.Wait();
+}
+
+/**
+ * Compute the PoW hashes of headers until one misses its target. The first
+ * header is hashed alone, the rest in rounds that double in size, so a peer
+ * sending bad PoW costs at most about twice the work of the good headers
+ * before it. Returns how many headers, from the first, have their hash in
+ * hashes.
+ */
+static size_t HashHeadersPoW(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashes, const Consensus::Params& consensusParams)
+{
+    hashes.resize(headers.size());
+    size_t nHashed = 0;
+    size_t nRound = 1;
+    while (nHashed < headers.size()) {
+        size_t nEnd = nHashed + std::min(nRound, headers.size() - nHashed);
+        HashHeadersPoW(&headers[nHashed], &hashes[nHashed], nEnd - nHashed);
+        for (; nHashed < nEnd; nHashed++) {
+            if (!CheckProofOfWork(hashes[nHashed], headers[nHashed].nBits, consensusParams, true))
+                return nEnd;
+        }
+        nRound = std::max(nRound * 2, HEADER_POW_CHECK_CHUNK);
+    }
+    return nHashed;
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2575,6 +2857,42 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+
+    // BIP16 didn't become active until Oct 1 2012
+    int64_t nBIP16SwitchTime = 1349049600;
+    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (pindex->nVersion >= 3 && IsSuperMajority(3, pindex->pprev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (pindex->nVersion >= 4 && IsSuperMajority(4, pindex->pprev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindex->pprev, consensusParams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindex->pprev, consensusParams)) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+        flags |= SCRIPT_VERIFY_NULLDUMMY;
+    }
+
+    return flags;
+}
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
                   CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
 {
@@ -2583,7 +2901,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int64_t nTimeStart = GetTimeMicros();
 
     // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
+    // Skip the scrypt hash if the header's PoW was verified when it entered the index
+    bool fCheckPOW = !fJustCheck && !(pindex->nStatus & BLOCK_POW_CHECKED);
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), fCheckPOW, !fJustCheck))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
 
     // verify that the view's current state corresponds to the previous block
@@ -2606,6 +2926,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fScriptChecks = false;
         }
     }
+    if (fScriptChecks && !hashAssumeValid.IsNull()) {
+        BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end() && it->second->GetAncestor(pindex->nHeight) == pindex &&
+            pindexBestHeader && pindexBestHeader->GetAncestor(pindex->nHeight) == pindex) {
+            // This block is an ancestor of the assumed-valid block and of our
+            // best header. Only skip script checks if it is buried under at
+            // least two weeks worth of work, so that an invalid block cannot
+            // be slipped in by convincing users to set -assumevalid to a
+            // recent hash.
+            fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
+        }
+    }
 
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
     LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
@@ -2624,44 +2956,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     bool fEnforceBIP30 = true;
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
-    // BIP16 didn't become active until Oct 1 2012
-    int64_t nBIP16SwitchTime = 1349049600;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
+    unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
 
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) along with BIP112 (CHECKSEQUENCEVERIFY).
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    if (flags & SCRIPT_VERIFY_CHECKSEQUENCEVERIFY) {
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
     }
 
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
-    }
-
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
@@ -2697,7 +3007,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             // Which orphan pool entries must we evict?
@@ -2733,7 +3043,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -2909,12 +3219,12 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
@@ -3137,6 +3447,9 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
         SyncWithWallets(tx, pindexNew, pblock);
     }
+    // Keep the new tip ready to serve to peers asking for it
+    if (nRecentBlockCacheUsage > 0 && !IsInitialBlockDownload())
+        recentBlockCache.Add(pindexNew->GetBlockHash(), *pblock, nRecentBlockCacheUsage);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
@@ -3644,34 +3957,28 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, const uint256* pPoWHash)
 {
-    // WarpSync check every 1/32th blocks pow hash (baz)
-    int syncheight = GetHeight();
-    if (syncheight > 1112500) { WarpSync=1; }
-    if (syncheight % WarpSync == 0) {
-        // Check proof of work matches claimed amount
-        if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(AlgoSwitch), block.nBits, consensusParams, true)){
-            if(WarpSync!=1){ LogPrintf("** HALTNG WarpSync DUE TO ERRORS ENCOUNTERED\n"); }
-            //if(AlgoSwitch){
-                //LogPrintf("** FAILED ON BALLOON (unrecoverable)\n");
-                //return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed (balloon pow)");
+    // Check proof of work matches claimed amount
+    if (fCheckPOW && !CheckProofOfWork(pPoWHash ? *pPoWHash : block.GetPoWHash(AlgoSwitch), block.nBits, consensusParams, true)){
+        //if(AlgoSwitch){
+            //LogPrintf("** FAILED ON BALLOON (unrecoverable)\n");
+            //return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed (balloon pow)");
+        //} else {
+            // could be failed balloon block
+            //if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(true), block.nBits, consensusParams, false)){
+                LogPrintf("** FAILED ON SCRYPT\n");
+                return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed (scrypt pow)");
             //} else {
-                // could be failed balloon block
-                //if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(true), block.nBits, consensusParams, false)){
-                    LogPrintf("** FAILED ON SCRYPT\n");
-                    return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed (scrypt pow)");
-                //} else {
-                    //LogPrintf("** ALGO SWITCHED TO BALLOON\n");
-                    //AlgoSwitch=true;				
-                //}
+                //LogPrintf("** ALGO SWITCHED TO BALLOON\n");
+                //AlgoSwitch=true;
             //}
-        }
+        //}
     }
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, const uint256* pPoWHash)
 {
     // These are checks that are independent of context.
 
@@ -3680,7 +3987,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
+    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW, pPoWHash))
         return false;
 
     // Check the merkle root.
@@ -3891,13 +4198,14 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, const uint256* pPoWHash=NULL)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
     uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
+    bool fPoWChecked = false;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
 
         if (miSelf != mapBlockIndex.end()) {
@@ -3910,8 +4218,9 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), true, pPoWHash))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
+        fPoWChecked = true;
 
         // Get prev block index
         CBlockIndex* pindexPrev = NULL;
@@ -3932,8 +4241,13 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         //      return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
         //}
     }
-    if (pindex == NULL)
+    if (pindex == NULL) {
         pindex = AddToBlockIndex(block);
+        if (fPoWChecked) {
+            pindex->nStatus |= BLOCK_POW_CHECKED;
+            setDirtyBlockIndex.insert(pindex);
+        }
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -3942,7 +4256,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 }
 
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, const uint256* pPoWHash=NULL)
 {
     if (fNewBlock) *fNewBlock = false;
     AssertLockHeld(cs_main);
@@ -3950,7 +4264,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, pPoWHash))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3975,7 +4289,10 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if ((!CheckBlock(block, state, chainparams.GetConsensus(), GetAdjustedTime())) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    // The header, and with it the proof of work, was checked when the index
+    // entry was created by AcceptBlockHeader above.
+    bool fCheckPOW = !(pindex->nStatus & BLOCK_POW_CHECKED);
+    if ((!CheckBlock(block, state, chainparams.GetConsensus(), fCheckPOW)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -3983,6 +4300,11 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
         return error("%s: %s", __func__, FormatStateMessage(state));
     }
 
+    // Start reading the block's inputs, while it is written to disk and
+    // waits to be connected.
+    if (pcoinsPrefetch)
+        pcoinsPrefetch->Prefetch(block, *pcoinsTip);
+
     int nHeight = pindex->nHeight;
 
     // Write block to history file
@@ -4126,6 +4448,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockfilemap.Release(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4410,7 +4733,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
             return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus(), !(pindex->nStatus & BLOCK_POW_CHECKED)))
             return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__, 
                          pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
         // check level 2: verify undo validity
@@ -4559,6 +4882,8 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    blockfilemap.Clear();
+    recentBlockCache.Clear();
     nBlockSequenceId = 1;
     mapBlockSource.clear();
     mapBlocksInFlight.clear();
@@ -4628,111 +4953,299 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+/** A block read from an external block file, on its way from the reader through the check threads to AcceptBlock. */
+struct CImportBlock
+{
+    //! Serialized block, released once deserialized
+    std::vector<char> vData;
+    //! Position and size of the serialized block in the file
+    uint64_t nBlockPos;
+    unsigned int nSize;
+    //! Where to resume scanning for the next block: past the block if it deserialized, else just past the message start
+    uint64_t nNextPos;
+
+    bool fRead;
+    std::string strError;
+    CBlock block;
+    uint256 hash;
+    uint256 powHash;
+
+    CImportBlock() : nBlockPos(0), nSize(0), nNextPos(0), fRead(false) {}
+};
+
+/**
+ * Closure deserializing a run of imported blocks and running the context-free
+ * checks on them (PoW, merkle root, CheckBlock), so that LoadExternalBlockFile
+ * only has to do the ordered AcceptBlock calls under cs_main.
+ */
+class CBlockImportCheck
+{
+private:
+    CImportBlock *pentries;
+    size_t nCount;
+    const Consensus::Params *pparams;
+
+public:
+    CBlockImportCheck(): pentries(NULL), nCount(0), pparams(NULL) {}
+    CBlockImportCheck(CImportBlock* pentriesIn, size_t nCountIn, const Consensus::Params& paramsIn) :
+        pentries(pentriesIn), nCount(nCountIn), pparams(&paramsIn) { }
+
+    bool operator()();
+
+    void swap(CBlockImportCheck &check) {
+        std::swap(pentries, check.pentries);
+        std::swap(nCount, check.nCount);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+bool CBlockImportCheck::operator()() {
+    std::vector<CBlockHeader> headers;
+    headers.reserve(nCount);
+    for (size_t i = 0; i < nCount; i++) {
+        CImportBlock& entry = pentries[i];
+        try {
+            CDataStream ss(entry.vData, SER_DISK, CLIENT_VERSION);
+            ss >> entry.block;
+            entry.nNextPos = entry.nBlockPos + entry.nSize - ss.size();
+            entry.fRead = true;
+            headers.push_back(entry.block.GetBlockHeader());
+        } catch (const std::exception& e) {
+            entry.strError = e.what();
+        }
+        std::vector<char>().swap(entry.vData);
+    }
+
+    std::vector<uint256> hashes;
+    GetPoWHashes(headers, hashes);
+    for (size_t i = 0, j = 0; i < nCount; i++) {
+        CImportBlock& entry = pentries[i];
+        if (!entry.fRead)
+            continue;
+        entry.hash = entry.block.GetHash();
+        entry.powHash = hashes[j++];
+        // Failures are left to AcceptBlock, which repeats the check (without
+        // rehashing) and records the outcome in the block index.
+        CValidationState state;
+        CheckBlock(entry.block, state, *pparams, true, true, &entry.powHash);
+    }
+    return true;
+}
+
+/** Blocks handled per CBlockImportCheck; enough to fill the widest scrypt backend. */
+static const size_t BLOCK_IMPORT_CHECK_CHUNK = 16;
+/** Limits on one batch of blocks read ahead of AcceptBlock during an import. */
+static const size_t BLOCK_IMPORT_BATCH_BLOCKS = 1024;
+static const size_t BLOCK_IMPORT_BATCH_BYTES = 16 * 1024 * 1024;
+
+static CCheckQueue<CBlockImportCheck> blockimportcheckqueue(4);
+static CCriticalSection cs_blockimportcheckqueue;
+
+void ThreadBlockImportCheck() {
+    RenameThread("mooncoin-impchk");
+    blockimportcheckqueue.Thread();
+}
+
+/**
+ * Read the next batch of serialized blocks from blkdat into vBatch, scanning
+ * for the message start from nRewind on, and leave nRewind past the last block
+ * read. Returns true when the end of the file was reached.
+ */
+static bool ReadImportBatch(const CChainParams& chainparams, CBufferedFile& blkdat, uint64_t& nRewind, std::vector<CImportBlock>& vBatch)
+{
+    // Rewinding after a block that failed to deserialize may go back further
+    // than the buffer keeps.
+    if (!blkdat.SetPos(nRewind) && !blkdat.Seek(nRewind))
+        LogPrintf("%s: Could not go back to position %u, skipping ahead\n", __func__, nRewind);
+
+    size_t nBytes = 0;
+    while (vBatch.size() < BLOCK_IMPORT_BATCH_BLOCKS && nBytes < BLOCK_IMPORT_BATCH_BYTES) {
+        boost::this_thread::interruption_point();
+        if (blkdat.eof())
+            return true;
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            return true;
+        }
+        try {
+            // read block
+            vBatch.push_back(CImportBlock());
+            CImportBlock& entry = vBatch.back();
+            entry.nBlockPos = blkdat.GetPos();
+            entry.nSize = nSize;
+            entry.nNextPos = nRewind;
+            blkdat.SetLimit(entry.nBlockPos + nSize);
+            entry.vData.resize(nSize);
+            blkdat.read(&entry.vData[0], nSize);
+            nRewind = blkdat.GetPos();
+            nBytes += nSize;
+        } catch (const std::exception& e) {
+            vBatch.pop_back();
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+    return false;
+}
+
+/** Hand one deserialized block from an external file to AcceptBlock. Returns false if the import has to stop. */
+static bool ProcessImportedBlock(const CChainParams& chainparams, CImportBlock& entry, CDiskBlockPos *dbp, std::multimap<uint256, CDiskBlockPos>& mapBlocksUnknownParent, int& nLoaded)
+{
+    CBlock& block = entry.block;
+    const uint256& hash = entry.hash;
+    if (dbp)
+        dbp->nPos = entry.nBlockPos;
+
+    // detect out of order blocks, and store them for later
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        LOCK(cs_main);
+        CValidationState state;
+        if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL, &entry.powHash))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+            {
+                LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
+                {
+                    nLoaded++;
+                    queue.push_back(block.GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
+    // The whole file is going to be read in order
+    AdviseSequentialRead(fileIn);
+
     int nLoaded = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+
+        // Blocks go through in batches: while the check threads deserialize
+        // and hash one batch, this thread feeds the previous one to
+        // AcceptBlock in file order.
+        std::vector<CImportBlock> vPending, vChecking;
+        vPending.reserve(BLOCK_IMPORT_BATCH_BLOCKS);
+        vChecking.reserve(BLOCK_IMPORT_BATCH_BLOCKS);
+        bool fEof = false;
+        bool fStop = false;
+        while (!fStop) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
+            vChecking.clear();
+            if (!fEof)
+                fEof = ReadImportBatch(chainparams, blkdat, nRewind, vChecking);
+            if (vChecking.empty() && vPending.empty())
                 break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
+            bool fRewind = false;
+            {
+                LOCK(cs_blockimportcheckqueue);
+                CCheckQueueControl<CBlockImportCheck> control(nScriptCheckThreads ? &blockimportcheckqueue : NULL);
+                std::vector<CBlockImportCheck> vChecks;
+                vChecks.reserve((vChecking.size() + BLOCK_IMPORT_CHECK_CHUNK - 1) / BLOCK_IMPORT_CHECK_CHUNK);
+                for (size_t i = 0; i < vChecking.size(); i += BLOCK_IMPORT_CHECK_CHUNK)
+                    vChecks.push_back(CBlockImportCheck(&vChecking[i], std::min(BLOCK_IMPORT_CHECK_CHUNK, vChecking.size() - i), chainparams.GetConsensus()));
+                if (nScriptCheckThreads)
+                    control.Add(vChecks);
+                else
+                    BOOST_FOREACH(CBlockImportCheck& check, vChecks)
+                        check();
+
+                BOOST_FOREACH(CImportBlock& entry, vPending) {
+                    boost::this_thread::interruption_point();
+                    try {
+                        if (!entry.fRead) {
+                            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, entry.strError);
+                        } else if (!ProcessImportedBlock(chainparams, entry, dbp, mapBlocksUnknownParent, nLoaded)) {
+                            fStop = true;
+                            break;
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
+                    } catch (const std::exception& e) {
+                        LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                    }
+                    // The reader assumed every block ends where its size
+                    // says; if this one did not, everything read after it
+                    // is void and scanning resumes where it really ended.
+                    if (entry.nNextPos != entry.nBlockPos + entry.nSize) {
+                        nRewind = entry.nNextPos;
+                        fRewind = true;
+                        break;
                     }
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                control.Wait();
+            }
+            if (fRewind) {
+                vPending.clear();
+                fEof = false;
+            } else {
+                vPending.swap(vChecking);
             }
         }
     } catch (const std::runtime_error& e) {
@@ -5000,12 +5513,13 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
             // requesting or processing some txs which have already been included in a block
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -5069,11 +5583,15 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    // Send block from the recent block cache, or else from disk
+                    const CRecentBlockCache::Entry* pcached = recentBlockCache.Get(inv.hash);
+                    CBlock blockRead;
+                    if (!pcached && !ReadBlockFromDisk(blockRead, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    const CBlock& block = pcached ? *pcached->block : blockRead;
+                    if (pcached && (inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK))
+                        pfrom->PushSharedMessage(pcached->payload[inv.type == MSG_WITNESS_BLOCK]);
+                    else if (inv.type == MSG_BLOCK)
                         pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
                     else if (inv.type == MSG_WITNESS_BLOCK)
                         pfrom->PushMessage(NetMsgType::BLOCK, block);
@@ -5113,7 +5631,9 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
                             CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
                             pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
-                        } else
+                        } else if (pcached)
+                            pfrom->PushSharedMessage(pcached->payload[fPeerWantsWitness]);
+                        else
                             pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
                     }
 
@@ -5136,7 +5656,11 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 bool push = false;
                 auto mi = mapRelay.find(inv.hash);
                 if (mi != mapRelay.end()) {
-                    pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
+                    // Serialized once for all the peers we relayed it to
+                    CNetPayloadRef& payload = mi->second.payload[inv.type == MSG_WITNESS_TX];
+                    if (!payload)
+                        payload = CNetPayload::Make(NetMsgType::TX, inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, *mi->second.tx);
+                    pfrom->PushSharedMessage(payload);
                     push = true;
                 } else if (pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
@@ -5507,15 +6031,30 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (pfrom->fWhitelisted && GetBoolArg("-whitelistrelay", DEFAULT_WHITELISTRELAY))
             fBlocksOnly = false;
 
+        // Announcements of transactions we already have in the mempool make up
+        // most of the inv traffic, and settling them needs no cs_main.
+        vector<CInv> vInvUnknown;
+        vInvUnknown.reserve(vInv.size());
+        BOOST_FOREACH(const CInv& inv, vInv)
+        {
+            if (fBlocksOnly || inv.type == MSG_BLOCK || !mempool.exists(inv.hash)) {
+                vInvUnknown.push_back(inv);
+                continue;
+            }
+            LogPrint("net", "got inv: %s  have peer=%d\n", inv.ToString(), pfrom->id);
+            pfrom->AddInventoryKnown(inv);
+            GetMainSignals().Inventory(inv.hash);
+        }
+
         LOCK(cs_main);
 
         uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
 
         std::vector<CInv> vToFetch;
 
-        for (unsigned int nInv = 0; nInv < vInv.size(); nInv++)
+        for (unsigned int nInv = 0; nInv < vInvUnknown.size(); nInv++)
         {
-            CInv &inv = vInv[nInv];
+            CInv &inv = vInvUnknown[nInv];
 
             boost::this_thread::interruption_point();
 
@@ -6170,14 +6709,24 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
-        {
-        LOCK(cs_main);
-
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
 
+        // Check that the headers connect before paying for their PoW. Only
+        // the prefix that forms a chain is hashed; the loop below punishes
+        // the break in the sequence when it gets there.
+        unsigned int nContinuous = 1;
+        while (nContinuous < nCount && headers[nContinuous].hashPrevBlock == headers[nContinuous - 1].GetHash())
+            nContinuous++;
+
+        std::vector<CBlockHeader> vNewHeaders;
+        std::vector<unsigned int> vNewIndex;
+        bool fConnects;
+        {
+        LOCK(cs_main);
+
         CNodeState *nodestate = State(pfrom->GetId());
 
         // If this looks like it could be a block announcement (nCount <
@@ -6188,7 +6737,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         //   don't connect before giving DoS points
         // - Once a headers message is received that is valid and does connect,
         //   nUnconnectingHeaders gets reset back to 0.
-        if (mapBlockIndex.find(headers[0].hashPrevBlock) == mapBlockIndex.end() && nCount < MAX_BLOCKS_TO_ANNOUNCE) {
+        fConnects = mapBlockIndex.find(headers[0].hashPrevBlock) != mapBlockIndex.end();
+        if (!fConnects && nCount < MAX_BLOCKS_TO_ANNOUNCE) {
             nodestate->nUnconnectingHeaders++;
             pfrom->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256());
             LogPrint("net", "received header %s: missing prev block %s, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
@@ -6207,14 +6757,42 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        if (fConnects) {
+            for (unsigned int n = 0; n < nContinuous; n++) {
+                if (!mapBlockIndex.count(headers[n].GetHash())) {
+                    vNewHeaders.push_back(headers[n]);
+                    vNewIndex.push_back(n);
+                }
+            }
+        }
+        }
+
+        // Hash the PoW of the headers we don't know yet in SIMD lanes across
+        // the check threads and without holding cs_main, so that
+        // AcceptBlockHeader below only has to compare them against nBits.
+        // A message that doesn't connect is rejected at its first header, and
+        // hashing stops soon after a header with bad PoW, which the loop below
+        // rejects.
+        std::vector<uint256> vPoWHashes;
+        std::vector<const uint256*> vpPoWHash(nCount, NULL);
+        size_t nHashed = HashHeadersPoW(vNewHeaders, vPoWHashes, chainparams.GetConsensus());
+        for (unsigned int i = 0; i < nHashed; i++)
+            vpPoWHash[vNewIndex[i]] = &vPoWHashes[i];
+
+        {
+        LOCK(cs_main);
+
+        CNodeState *nodestate = State(pfrom->GetId());
+
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, vpPoWHash[n])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6349,7 +6927,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -6706,6 +7287,29 @@ public:
     }
 };
 
+/**
+ * The cmpctblock message announcing pindex. It is built once per block and
+ * shared by all the high-bandwidth peers it is announced to.
+ */
+static CNetPayloadRef GetCmpctBlockAnnouncement(const CBlockIndex* pindex, bool fWitness, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+    if (hashAnnouncedCmpctBlock != pindex->GetBlockHash()) {
+        hashAnnouncedCmpctBlock = pindex->GetBlockHash();
+        vAnnouncedCmpctBlock[0] = vAnnouncedCmpctBlock[1] = CNetPayloadRef();
+    }
+    CNetPayloadRef& payload = vAnnouncedCmpctBlock[fWitness];
+    if (!payload) {
+        const CRecentBlockCache::Entry* pcached = recentBlockCache.Get(pindex->GetBlockHash());
+        CBlock blockRead;
+        if (!pcached)
+            assert(ReadBlockFromDisk(blockRead, pindex, consensusParams));
+        CBlockHeaderAndShortTxIDs cmpctblock(pcached ? *pcached->block : blockRead, fWitness);
+        payload = CNetPayload::Make(NetMsgType::CMPCTBLOCK, fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, cmpctblock);
+    }
+    return payload;
+}
+
 bool SendMessages(CNode* pto)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -6759,6 +7363,7 @@ bool SendMessages(CNode* pto)
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_vAddrToSend);
             vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
@@ -6908,11 +7513,7 @@ bool SendMessages(CNode* pto)
                     // probably means we're doing an initial-ish-sync or they're slow
                     LogPrint("net", "%s sending header-and-ids %s to peer %d\n", __func__,
                             vHeaders.front().GetHash().ToString(), pto->id);
-                    //TODO: Shouldn't need to reload block from disk, but requires refactor
-                    CBlock block;
-                    assert(ReadBlockFromDisk(block, pBestIndex, consensusParams));
-                    CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
-                    pto->PushMessageWithFlag(state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
+                    pto->PushSharedMessage(GetCmpctBlockAnnouncement(pBestIndex, state.fWantsCmpctWitness, consensusParams));
                     state.pindexBestHeaderSent = pBestIndex;
                 } else if (state.fPreferHeaders) {
                     if (vHeaders.size() > 1) {
@@ -7076,7 +7677,7 @@ bool SendMessages(CNode* pto)
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.insert(std::make_pair(hash, CRelayedTx(std::move(txinfo.tx))));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -7183,7 +7784,7 @@ bool SendMessages(CNode* pto)
             // until scheduled broadcast, then move the broadcast to within MAX_FEEFILTER_CHANGE_DELAY.
             else if (timeNow + MAX_FEEFILTER_CHANGE_DELAY * 1000000 < pto->nextSendTimeFeeFilter &&
                      (currentFilter < 3 * pto->lastSentFeeFilter / 4 || currentFilter > 4 * pto->lastSentFeeFilter / 3)) {
-                pto->nextSendTimeFeeFilter = timeNow + (insecure_rand() % MAX_FEEFILTER_CHANGE_DELAY) * 1000000;
+                pto->nextSendTimeFeeFilter = timeNow + GetRandInt(MAX_FEEFILTER_CHANGE_DELAY) * 1000000;
             }
         }
     }
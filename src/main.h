@@ -33,6 +33,7 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewPrefetch;
 class CInv;
 class CScriptCheck;
 class CTxMemPool;
@@ -132,6 +133,10 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 90 * 24 * 60 * 60;      // 3mnth is s
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -mmapblocks */
+static const bool DEFAULT_MAPBLOCKFILES = false;
+/** Default for -recentblockcache, in megabytes */
+static const unsigned int DEFAULT_RECENT_BLOCK_CACHE = 16;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
@@ -172,7 +177,13 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Whether finalized block and undo files are read through memory mappings (-mmapblocks) */
+extern bool fMapBlockFiles;
+/** Block hash whose ancestors we will assume to have valid scripts without checking them. */
+extern uint256 hashAssumeValid;
 extern size_t nCoinCacheUsage;
+/** Memory budget for recently connected blocks kept serialized for getdata (-recentblockcache) */
+extern size_t nRecentBlockCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -254,6 +265,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof-of-work hashing thread */
+void ThreadHeaderPoWCheck();
+/** Run an instance of the block import check thread */
+void ThreadBlockImportCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -269,6 +284,42 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, const Consensus::Para
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock = NULL);
 CAmount GetBlockSubsidy(int nHeight, uint256 prevHash);
+/**
+ * Seed for the random-reward era: the 7 hex digits at offset 7 of
+ * prevHash.ToString(), read straight from the little-endian bytes.
+ * The hex string runs from byte 31 down to byte 0, so digits 7..13 are the
+ * low nibble of byte 28 followed by bytes 27, 26 and 25.
+ */
+unsigned int GetSubsidySeed(const uint256& prevHash);
+
+/**
+ * Lazily seeded MT19937 yielding the same sequence as boost::random::mt19937.
+ * Output k only depends on seed words k, k+1 and k+397, so the first draws
+ * need neither the full 624-word seeding nor a twist of the whole state.
+ * GetBlockSubsidy draws once or twice per block, which makes this several
+ * times cheaper than constructing the real engine.
+ */
+class CLazyMT19937
+{
+private:
+    static const int N = 624;
+    static const int M = 397;
+    uint32_t x[N];
+    int nSeeded;
+    int nDrawn;
+
+    uint32_t Word(int i);
+
+public:
+    typedef uint32_t result_type;
+
+    explicit CLazyMT19937(uint32_t s) : nSeeded(1), nDrawn(0) { x[0] = s; }
+
+    result_type min() const { return 0; }
+    result_type max() const { return 0xffffffff; }
+
+    result_type operator()();
+};
 
 /**
  * Prune block and undo files (blk???.dat and undo???.dat) so that the disk space used is less than a user-defined target.
@@ -350,10 +401,11 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. With cacheFullScriptStore, a transaction whose scripts all
+ * pass is remembered as valid under flags; without it, such an entry is used up by the lookup.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -418,8 +470,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -438,6 +490,32 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure computing the PoW hashes of a run of consecutive block headers, so
+ * that a headers message can be hashed on the check threads before cs_main is
+ * taken. The comparison against nBits is left to CheckBlockHeader.
+ */
+class CHeaderPoWCheck
+{
+private:
+    const CBlockHeader *pheaders;
+    uint256 *phashes;
+    size_t nCount;
+
+public:
+    CHeaderPoWCheck(): pheaders(NULL), phashes(NULL), nCount(0) {}
+    CHeaderPoWCheck(const CBlockHeader* pheadersIn, uint256* phashesIn, size_t nCountIn) :
+        pheaders(pheadersIn), phashes(phashesIn), nCount(nCountIn) { }
+
+    bool operator()();
+
+    void swap(CHeaderPoWCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(phashes, check.phashes);
+        std::swap(nCount, check.nCount);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
@@ -446,9 +524,9 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 /** Functions for validating blocks and updating the block tree */
 
-/** Context-independent validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** Context-independent validity checks. pPoWHash, if given, is the already computed block.GetPoWHash(). */
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, const uint256* pPoWHash = NULL);
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, const uint256* pPoWHash = NULL);
 
 /** Context-dependent validity checks.
  *  By "context", we mean only the previous block headers, but not the UTXO
@@ -506,6 +584,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the view reading block inputs ahead of pcoinsTip */
+extern CCoinsViewPrefetch *pcoinsPrefetch;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
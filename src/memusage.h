@@ -5,6 +5,7 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "arenamap.h"
 #include "indirectmap.h"
 
 #include <stdlib.h>
@@ -146,6 +147,18 @@ static inline size_t DynamicUsage(const std::shared_ptr<X>& p)
     return p ? MallocUsage(sizeof(X)) + MallocUsage(sizeof(stl_shared_counter)) : 0;
 }
 
+// arenamap has a table of slots and its arena chunks
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const arenamap<X, Y, Z>& m)
+{
+    size_t usage = MallocUsage(sizeof(typename arenamap<X, Y, Z>::slot) * m.bucket_count()) +
+                   MallocUsage(sizeof(std::pair<void*, size_t>) * m.chunk_capacity());
+    for (size_t i = 0; i < m.chunk_count(); i++)
+        usage += MallocUsage(m.chunk_bytes(i));
+    return usage;
+}
+
 // Boost data structures
 
 template<typename X>
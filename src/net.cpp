@@ -27,6 +27,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -111,6 +115,8 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+/** Mutex the message handler threads wait on messageHandlerCondition with */
+static boost::mutex messageHandlerMutex;
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -824,26 +830,74 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+/** Most buffers handed to the kernel by one SocketSendData call */
+static const size_t MAX_SEND_BUFFERS = 64;
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    while (!pnode->vSendMsg.empty()) {
+        // Gather the unsent buffers of the queued messages: each message's
+        // own data, then its shared payload. nSendOffset counts into both.
+        const char* vpch[MAX_SEND_BUFFERS];
+        size_t vnLen[MAX_SEND_BUFFERS];
+        size_t nBuffers = 0;
+        size_t nToSend = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (std::deque<CSendMessage>::const_iterator it = pnode->vSendMsg.begin(); it != pnode->vSendMsg.end() && nBuffers + 2 <= MAX_SEND_BUFFERS; it++) {
+            const CSendMessage& msg = *it;
+            const CSerializeData* vParts[2] = { &msg.data, msg.payload ? &msg.payload->vData : NULL };
+            for (int i = 0; i < 2; i++) {
+                if (!vParts[i])
+                    continue;
+                size_t nSize = vParts[i]->size();
+                if (nOffset >= nSize) {
+                    nOffset -= nSize;
+                    continue;
+                }
+                vpch[nBuffers] = &(*vParts[i])[nOffset];
+                vnLen[nBuffers] = nSize - nOffset;
+                nToSend += vnLen[nBuffers];
+                nBuffers++;
+                nOffset = 0;
+            }
+        }
+        assert(nBuffers > 0);
 
-    while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+        // No scatter-gather send; go one buffer at a time
+        nToSend = vnLen[0];
+        int nBytes = send(pnode->hSocket, vpch[0], vnLen[0], MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        struct iovec iov[MAX_SEND_BUFFERS];
+        for (size_t i = 0; i < nBuffers; i++) {
+            iov[i].iov_base = (void*)vpch[i];
+            iov[i].iov_len = vnLen[i];
+        }
+        struct msghdr msghdr = {};
+        msghdr.msg_iov = iov;
+        msghdr.msg_iovlen = nBuffers;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msghdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            size_t nSent = nBytes;
+            while (nSent > 0) {
+                const CSendMessage& msg = pnode->vSendMsg.front();
+                size_t nLeft = msg.size() - pnode->nSendOffset;
+                if (nSent < nLeft) {
+                    pnode->nSendOffset += nSent;
+                    break;
+                }
+                nSent -= nLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                it++;
-            } else {
-                // could not send full message; stop sending more
+                pnode->nSendSize -= msg.size();
+                pnode->vSendMsg.pop_front();
+            }
+            if ((size_t)nBytes < nToSend) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -861,11 +915,10 @@ void SocketSendData(CNode *pnode)
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
+    if (pnode->vSendMsg.empty()) {
         assert(pnode->nSendOffset == 0);
         assert(pnode->nSendSize == 0);
     }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
 }
 
 static std::list<CNode*> vNodesDisconnected;
@@ -1088,6 +1141,192 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+/** How long the socket handler waits for socket events, which is also how often pnode->vSend is polled */
+static const int SOCKET_WAIT_MILLIS = 50;
+
+/** What the socket handler waits for on a node's socket */
+enum SocketInterest
+{
+    SOCKET_WANT_NONE = 0,
+    SOCKET_WANT_RECV = 1,
+    SOCKET_WANT_SEND = 2,
+};
+
+static int GetSocketInterest(CNode* pnode)
+{
+    // Implement the following logic:
+    // * If there is data to send, select() for sending data. As this only
+    //   happens when optimistic write failed, we choose to first drain the
+    //   write buffer in this case before receiving more. This avoids
+    //   needlessly queueing received data, if the remote peer is not themselves
+    //   receiving data. This means properly utilizing TCP flow control signalling.
+    // * Otherwise, if there is no (complete) message in the receive buffer,
+    //   or there is space left in the buffer, select() for receiving data.
+    // * (if neither of the above applies, there is certainly one message
+    //   in the receiver buffer ready to be processed).
+    // Together, that means that at least one of the following is always possible,
+    // so we don't deadlock:
+    // * We send some data.
+    // * We wait for data to be received (and disconnect after timeout).
+    // * We process a message in the buffer (message handler thread).
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (lockSend && !pnode->vSendMsg.empty())
+            return SOCKET_WANT_SEND;
+    }
+    {
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        if (lockRecv && (
+            pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+            pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+            return SOCKET_WANT_RECV;
+    }
+    return SOCKET_WANT_NONE;
+}
+
+#ifdef USE_EPOLL
+/** Maximum number of events taken from the epoll set per wakeup; the rest are reported on the next one */
+static const int MAX_EPOLL_EVENTS = 1024;
+
+/** Socket handler's epoll set, holding the listen sockets and every node socket */
+static int hEpoll = -1;
+
+/**
+ * Wait for socket events on the epoll set. Node sockets are added once and
+ * only modified when GetSocketInterest changes, e.g. when vSendMsg fills up
+ * and writability is wanted.
+ */
+static void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    if (hEpoll == -1) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1) {
+            LogPrintf("socket epoll_create1 error %s\n", NetworkErrorString(errno));
+            MilliSleep(SOCKET_WAIT_MILLIS);
+            return;
+        }
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = hListenSocket.socket;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+                LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(errno));
+        }
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            int nInterest = GetSocketInterest(pnode);
+            if (nInterest == pnode->nSocketInterest)
+                continue;
+
+            // Errors and hangups are always reported, also when nothing else is wanted
+            struct epoll_event event = {};
+            if (nInterest & SOCKET_WANT_RECV)
+                event.events |= EPOLLIN;
+            if (nInterest & SOCKET_WANT_SEND)
+                event.events |= EPOLLOUT;
+            event.data.fd = pnode->hSocket;
+            int nOp = pnode->nSocketInterest == -1 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            if (epoll_ctl(hEpoll, nOp, pnode->hSocket, &event) != 0) {
+                LogPrint("net", "socket epoll_ctl error %s for peer=%d\n", NetworkErrorString(errno), pnode->id);
+                continue;
+            }
+            pnode->nSocketInterest = nInterest;
+        }
+    }
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(hEpoll, events, MAX_EPOLL_EVENTS, SOCKET_WAIT_MILLIS);
+    if (nEvents == -1) {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(SOCKET_WAIT_MILLIS);
+        }
+        return;
+    }
+    for (int i = 0; i < nEvents; i++) {
+        SOCKET hSocket = events[i].data.fd;
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            error_set.insert(hSocket);
+        if (events[i].events & EPOLLIN)
+            recv_set.insert(hSocket);
+        if (events[i].events & EPOLLOUT)
+            send_set.insert(hSocket);
+    }
+}
+#else
+/** Wait for socket events with select(), over fd_sets rebuilt on every call. */
+static void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = SOCKET_WAIT_MILLIS * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    std::vector<SOCKET> vSockets;
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        vSockets.push_back(hListenSocket.socket);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
+            vSockets.push_back(pnode->hSocket);
+
+            int nInterest = GetSocketInterest(pnode);
+            if (nInterest & SOCKET_WANT_SEND)
+                FD_SET(pnode->hSocket, &fdsetSend);
+            else if (nInterest & SOCKET_WANT_RECV)
+                FD_SET(pnode->hSocket, &fdsetRecv);
+        }
+    }
+
+    bool have_fds = !vSockets.empty();
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            recv_set.insert(vSockets.begin(), vSockets.end());
+        }
+        MilliSleep(SOCKET_WAIT_MILLIS);
+        return;
+    }
+
+    BOOST_FOREACH(SOCKET hSocket, vSockets) {
+        if (FD_ISSET(hSocket, &fdsetRecv))
+            recv_set.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetSend))
+            send_set.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetError))
+            error_set.insert(hSocket);
+    }
+}
+#endif
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1159,91 +1398,16 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::set<SOCKET> recv_set, send_set, error_set;
+        SocketEvents(recv_set, send_set, error_set);
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
-        }
-
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1268,7 +1432,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (recv_set.count(pnode->hSocket) || error_set.count(pnode->hSocket))
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -1312,7 +1476,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (send_set.count(pnode->hSocket))
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
@@ -1849,11 +2013,15 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
 }
 
 
-void ThreadMessageHandler()
+/**
+ * Process messages from and send messages to the nodes. Several of these
+ * threads run side by side; each node is handled by one of them at a time,
+ * so the messages of a peer stay ordered while a peer whose messages are slow
+ * to process (or wait for cs_main) only holds up the thread handling it.
+ * Threads start their pass over the nodes at different offsets to spread them.
+ */
+void ThreadMessageHandler(int nThread, int nThreads)
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
-
     while (true)
     {
         std::vector<CNode*> vNodesCopy;
@@ -1867,11 +2035,17 @@ void ThreadMessageHandler()
 
         bool fSleep = true;
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        size_t nStart = vNodesCopy.size() * nThread / nThreads;
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[(nStart + i) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
+            // Skip nodes another handler thread is busy with
+            if (pnode->fInMessageHandler.exchange(true))
+                continue;
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1889,7 +2063,6 @@ void ThreadMessageHandler()
                     }
                 }
             }
-            boost::this_thread::interruption_point();
 
             // Send messages
             {
@@ -1897,6 +2070,8 @@ void ThreadMessageHandler()
                 if (lockSend)
                     GetNodeSignals().SendMessages(pnode);
             }
+
+            pnode->fInMessageHandler = false;
             boost::this_thread::interruption_point();
         }
 
@@ -1906,8 +2081,10 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
+        if (fSleep) {
+            boost::unique_lock<boost::mutex> lock(messageHandlerMutex);
             messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        }
     }
 }
 
@@ -2136,7 +2313,9 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    int nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&ThreadMessageHandler, i, nMessageHandlerThreads))));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
@@ -2174,6 +2353,10 @@ public:
             if (hListenSocket.socket != INVALID_SOCKET)
                 if (!CloseSocket(hListenSocket.socket))
                     LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
+#ifdef USE_EPOLL
+        if (hEpoll != -1)
+            close(hEpoll);
+#endif
 
         // clean up some globals (to help leak detection)
         BOOST_FOREACH(CNode *pnode, vNodes)
@@ -2471,6 +2654,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nServices = NODE_NONE;
     nServicesExpected = NODE_NONE;
     hSocket = hSocketIn;
+    nSocketInterest = -1;
     nRecvVersion = INIT_PROTO_VERSION;
     nLastSend = 0;
     nLastRecv = 0;
@@ -2490,6 +2674,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fSuccessfullyConnected = false;
     fDisconnect = false;
     nRefCount = 0;
+    fInMessageHandler = false;
     nSendSize = 0;
     nSendOffset = 0;
     hashContinue = uint256();
@@ -2632,9 +2817,9 @@ void CNode::EndMessage(const char* pszCommand) UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    std::deque<CSendMessage>::iterator it = vSendMsg.insert(vSendMsg.end(), CSendMessage());
+    ssSend.GetAndClear(it->data);
+    nSendSize += it->size();
 
     // If write queue empty, attempt "optimistic write"
     if (it == vSendMsg.begin())
@@ -2643,6 +2828,42 @@ void CNode::EndMessage(const char* pszCommand) UNLOCK_FUNCTION(cs_vSend)
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
+void CNode::PushSharedMessage(const CNetPayloadRef& payload)
+{
+    LOCK(cs_vSend);
+    if (mapArgs.count("-dropmessagestest") && GetRand(GetArg("-dropmessagestest", 2)) == 0)
+    {
+        LogPrint("net", "dropmessages DROPPING SEND MESSAGE\n");
+        return;
+    }
+
+    CMessageHeader hdr(Params().MessageStart(), payload->strCommand.c_str(), payload->vData.size());
+    hdr.nChecksum = payload->nChecksum;
+    CDataStream ssHeader(SER_NETWORK, INIT_PROTO_VERSION);
+    ssHeader << hdr;
+
+    //log total amount of bytes per command
+    mapSendBytesPerMsgCmd[payload->strCommand] += CMessageHeader::HEADER_SIZE + payload->vData.size();
+
+    LogPrint("net", "sending: %s (%d bytes, shared) peer=%d\n", SanitizeString(payload->strCommand), payload->vData.size(), id);
+
+    std::deque<CSendMessage>::iterator it = vSendMsg.insert(vSendMsg.end(), CSendMessage());
+    ssHeader.GetAndClear(it->data);
+    it->payload = payload;
+    nSendSize += it->size();
+
+    // If write queue empty, attempt "optimistic write"
+    if (it == vSendMsg.begin())
+        SocketSendData(this);
+}
+
+CNetPayload::CNetPayload(const char* pszCommand, CSerializeData&& vDataIn) :
+    strCommand(pszCommand), vData(std::move(vDataIn)), nChecksum(0)
+{
+    uint256 hash = Hash(vData.begin(), vData.end());
+    memcpy(&nChecksum, hash.begin(), sizeof(nChecksum));
+}
+
 //
 // CBanDB
 //
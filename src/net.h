@@ -19,6 +19,7 @@
 
 #include <atomic>
 #include <deque>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -71,6 +72,10 @@ static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 static const bool DEFAULT_BLOCKSONLY = false;
 
 static const bool DEFAULT_FORCEDNSSEED = false;
+/** Default for -msghandlerthreads, the number of threads processing peer messages */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 4;
+/** Maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
@@ -256,6 +261,46 @@ public:
 };
 
 
+class CNetPayload;
+typedef std::shared_ptr<const CNetPayload> CNetPayloadRef;
+
+/**
+ * A serialized message payload that is immutable once built, so that the
+ * same block or transaction can be queued on many nodes without serializing
+ * or copying it again for each of them.
+ */
+class CNetPayload
+{
+public:
+    const std::string strCommand;
+    const CSerializeData vData;
+    //! First 4 bytes of the double-SHA256 of vData, as it goes in the message header
+    unsigned int nChecksum;
+
+    CNetPayload(const char* pszCommand, CSerializeData&& vDataIn);
+
+    /** Serialize obj as the payload of a pszCommand message, with the serialization flags nFlags (e.g. SERIALIZE_TRANSACTION_NO_WITNESS) */
+    template<typename T>
+    static CNetPayloadRef Make(const char* pszCommand, int nFlags, const T& obj)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | nFlags);
+        ss << obj;
+        CSerializeData vData;
+        ss.GetAndClear(vData);
+        return std::make_shared<const CNetPayload>(pszCommand, std::move(vData));
+    }
+};
+
+/** A message in a node's send queue: data serialized for this node, followed by a shared payload if there is one. */
+struct CSendMessage
+{
+    CSerializeData data;
+    CNetPayloadRef payload;
+
+    size_t size() const { return data.size() + (payload ? payload->vData.size() : 0); }
+};
+
+
 typedef enum BanReason
 {
     BanReasonUnknown          = 0,
@@ -325,11 +370,12 @@ public:
     ServiceFlags nServices;
     ServiceFlags nServicesExpected;
     SOCKET hSocket;
+    int nSocketInterest; //!< SocketInterest registered with the socket handler's epoll set, -1 if not registered
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSendMessage> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -369,6 +415,8 @@ public:
     CCriticalSection cs_filter;
     CBloomFilter* pfilter;
     int nRefCount;
+    // Set while a message handler thread is processing or sending messages for this node
+    std::atomic<bool> fInMessageHandler;
     NodeId id;
 
     const uint64_t nKeyedNetGroup;
@@ -396,8 +444,11 @@ public:
     int nStartingHeight;
 
     // flood relay
+    // vAddrToSend and addrKnown are also written while other peers' messages
+    // are processed, protected by cs_vAddrToSend
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -514,6 +565,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -522,9 +574,10 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
-                vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
+                vAddrToSend[GetRand(vAddrToSend.size())] = addr;
             } else {
                 vAddrToSend.push_back(addr);
             }
@@ -569,6 +622,9 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage(const char* pszCommand) UNLOCK_FUNCTION(cs_vSend);
 
+    /** Queue a payload that may also be queued on other nodes, behind a header of our own. */
+    void PushSharedMessage(const CNetPayloadRef& payload);
+
     void PushVersion();
 
 
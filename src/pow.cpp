@@ -9,7 +9,7 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "primitives/block.h"
-#include "bignum.h"
+#include "sync.h"
 #include "uint256.h"
 #include "util.h"
 
@@ -87,14 +87,16 @@ unsigned int GetNextWorkRequired_V1(const CBlockIndex* pindexLast, const CBlockH
         }
 
     // Retarget
-    CBigNum bnNew;
-    CBigNum bnOld;
+    arith_uint256 bnNew;
+    arith_uint256 bnOld;
     bnNew.SetCompact(pindexLast->nBits);
     bnOld = bnNew;
     bnNew *= nActualTimespan;
     bnNew /= params.nPowTargetSpacing;
 
-    if (bnNew > nProofOfWorkLimit)
+    // Compared against the compact encoding taken as a number, as the
+    // CBigNum(unsigned int) conversion this code was written for did.
+    if (bnNew > arith_uint256(nProofOfWorkLimit))
         bnNew = nProofOfWorkLimit;
 
     /// debug print
@@ -108,66 +110,159 @@ unsigned int GetNextWorkRequired_V1(const CBlockIndex* pindexLast, const CBlockH
     return bnNew.GetCompact();
 }
 
+/**
+ * State left by walking the KGW ancestor window back from a tip. It depends
+ * only on the tip and the window parameters, never on the block being built.
+ */
+struct KGWWindow
+{
+    uint256 hashTip;
+    int64_t TargetBlocksSpacingSeconds;
+    uint64_t PastBlocksMin;
+    uint64_t PastBlocksMax;
+    int nHeightReading;
+    arith_uint256 PastDifficultyAverage;
+    int64_t PastRateActualSeconds;
+    int64_t PastRateTargetSeconds;
+    double PastRateAdjustmentRatio;
+};
+
+/**
+ * Walk back from pindexLast until the event horizon is crossed or PastBlocksMax
+ * blocks have been seen, accumulating the rolling average difficulty.
+ * HorizonBlocks is the block count the event horizon deviation is scaled by.
+ */
+static void KGWWalkWindow(const CBlockIndex* pindexLast, int64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, double HorizonBlocks, KGWWindow& window)
+{
+    const CBlockIndex *BlockLastSolved = pindexLast;
+    const CBlockIndex *BlockReading = pindexLast;
+    uint64_t PastBlocksMass = 0;
+    int64_t PastRateActualSeconds = 0;
+    int64_t PastRateTargetSeconds = 0;
+    double PastRateAdjustmentRatio = double(1);
+    arith_uint256 PastDifficultyAverage;
+    arith_uint256 PastDifficultyAveragePrev;
+    double EventHorizonDeviation;
+    double EventHorizonDeviationFast;
+    double EventHorizonDeviationSlow;
+
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
+        if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
+        PastBlocksMass++;
+        PastDifficultyAverage.SetCompact(BlockReading->nBits);
+        if (i > 1) {
+            // Same as a signed division truncating towards zero
+            // (the 32-bit divisor takes the short division path).
+            if (PastDifficultyAverage >= PastDifficultyAveragePrev) {
+                PastDifficultyAverage -= PastDifficultyAveragePrev;
+                PastDifficultyAverage /= (uint32_t)i;
+                PastDifficultyAverage += PastDifficultyAveragePrev;
+            } else {
+                arith_uint256 delta = PastDifficultyAveragePrev - PastDifficultyAverage;
+                delta /= (uint32_t)i;
+                PastDifficultyAverage = PastDifficultyAveragePrev - delta;
+            }
+        }
+        PastDifficultyAveragePrev = PastDifficultyAverage;
+        PastRateActualSeconds = BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
+        PastRateTargetSeconds = TargetBlocksSpacingSeconds * PastBlocksMass;
+        PastRateAdjustmentRatio = double(1);
+        if (PastRateActualSeconds < 0) { PastRateActualSeconds = 0; }
+        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
+        }
+        EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass)/HorizonBlocks), -1.228));
+        EventHorizonDeviationFast = EventHorizonDeviation;
+        EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
+
+        if (PastBlocksMass >= PastBlocksMin) {
+                if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast))
+                { assert(BlockReading); break; }
+        }
+        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
+        BlockReading = BlockReading->pprev;
+    }
+
+    window.hashTip = pindexLast->GetBlockHash();
+    window.TargetBlocksSpacingSeconds = TargetBlocksSpacingSeconds;
+    window.PastBlocksMin = PastBlocksMin;
+    window.PastBlocksMax = PastBlocksMax;
+    window.nHeightReading = BlockReading->nHeight;
+    window.PastDifficultyAverage = PastDifficultyAverage;
+    window.PastRateActualSeconds = PastRateActualSeconds;
+    window.PastRateTargetSeconds = PastRateTargetSeconds;
+    window.PastRateAdjustmentRatio = PastRateAdjustmentRatio;
+}
+
+/**
+ * Memo of the last window walked for each KGW variant. Templates and blocks
+ * built on the same tip reuse it instead of walking up to PastBlocksMax
+ * ancestors again; a new tip needs a fresh walk since the average is anchored
+ * at the tip.
+ */
+static CCriticalSection cs_kgwcache;
+static KGWWindow kgwCache[2];
+static bool fKGWCacheValid[2] = { false, false };
+
+enum KGWVariant { KGW_V2 = 0, KGW_DUAL3 = 1 };
+
+static void GetKGWWindow(KGWVariant variant, const CBlockIndex* pindexLast, int64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, double HorizonBlocks, KGWWindow& window)
+{
+    LOCK(cs_kgwcache);
+    const KGWWindow& cached = kgwCache[variant];
+    if (!fKGWCacheValid[variant] || cached.hashTip != pindexLast->GetBlockHash() ||
+        cached.TargetBlocksSpacingSeconds != TargetBlocksSpacingSeconds ||
+        cached.PastBlocksMin != PastBlocksMin || cached.PastBlocksMax != PastBlocksMax) {
+        KGWWalkWindow(pindexLast, TargetBlocksSpacingSeconds, PastBlocksMin, PastBlocksMax, HorizonBlocks, kgwCache[variant]);
+        fKGWCacheValid[variant] = true;
+    }
+    window = kgwCache[variant];
+}
+
+/**
+ * a = a * n / d with the rounding of unbounded integer arithmetic, for n, d > 0.
+ * Returns false, leaving a untouched, if the result may not fit in 255 bits;
+ * it is then larger than any proof-of-work limit.
+ */
+static bool MulDivTarget(arith_uint256& a, int64_t n, int64_t d)
+{
+    const arith_uint256 bnN((uint64_t)n);
+    const arith_uint256 bnD((uint64_t)d);
+    arith_uint256 q = a / bnD;
+    arith_uint256 r = a - q * bnD;
+    if (q.bits() + bnN.bits() > 255)
+        return false;
+    a = q * bnN + (r * bnN) / bnD;
+    return true;
+}
+
 unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params) {
 
-    CBigNum bnProofOfWorkLimit = UintToArith256(params.powLimit).GetCompact();
+    // The limit is the compact encoding taken as a number, as the
+    // CBigNum(unsigned int) conversion this code was written for did.
+    const arith_uint256 bnProofOfWorkLimit(UintToArith256(params.powLimit).GetCompact());
 
     /* current difficulty formula, megacoin - kimoto gravity well */
     const CBlockIndex  *BlockLastSolved                             = pindexLast;
-    const CBlockIndex  *BlockReading                                = pindexLast;
-    const CBlockHeader *BlockCreating                               = pblock;
-                        BlockCreating                               = BlockCreating;
-    uint64                                PastBlocksMass                       = 0;
-    int64                                 PastRateActualSeconds                = 0;
-    int64                                 PastRateTargetSeconds                = 0;
-    double                                PastRateAdjustmentRatio              = double(1);
-    CBigNum                               PastDifficultyAverage;
-    CBigNum                               PastDifficultyAveragePrev;
-    double                                EventHorizonDeviation;
-    double                                EventHorizonDeviationFast;
-    double                                EventHorizonDeviationSlow;
 
     if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || (uint64)BlockLastSolved->nHeight < PastBlocksMin) { return bnProofOfWorkLimit.GetCompact(); }
 
-  	for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-		if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
-		PastBlocksMass++;
-		
-		if (i == 1)	{ PastDifficultyAverage.SetCompact(BlockReading->nBits); }
-		else		{ PastDifficultyAverage = ((CBigNum().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev; }
-		PastDifficultyAveragePrev = PastDifficultyAverage;
-		
-		PastRateActualSeconds			= BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
-		PastRateTargetSeconds			= TargetBlocksSpacingSeconds * PastBlocksMass;
-		PastRateAdjustmentRatio			= double(1);
-		if (PastRateActualSeconds < 0) { PastRateActualSeconds = 0; }
-		if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
-		PastRateAdjustmentRatio			= double(PastRateTargetSeconds) / double(PastRateActualSeconds);
-		}
-		EventHorizonDeviation			= 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
-		EventHorizonDeviationFast		= EventHorizonDeviation;
-		EventHorizonDeviationSlow		= 1 / EventHorizonDeviation;
-		
-		if (PastBlocksMass >= PastBlocksMin) {
-			if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast)) { assert(BlockReading); break; }
-		}
-		if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-		BlockReading = BlockReading->pprev;
-	}
-	
-	CBigNum bnNew(PastDifficultyAverage);
-	if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
-		bnNew *= PastRateActualSeconds;
-		bnNew /= PastRateTargetSeconds;
+    KGWWindow window;
+    GetKGWWindow(KGW_V2, pindexLast, TargetBlocksSpacingSeconds, PastBlocksMin, PastBlocksMax, 144, window);
+
+	arith_uint256 bnNew(window.PastDifficultyAverage);
+	if (window.PastRateActualSeconds != 0 && window.PastRateTargetSeconds != 0) {
+		if (!MulDivTarget(bnNew, window.PastRateActualSeconds, window.PastRateTargetSeconds))
+			bnNew = bnProofOfWorkLimit;
 	}
     if (bnNew > bnProofOfWorkLimit) { bnNew = bnProofOfWorkLimit; }
  
     if(fDebug){
 		/// debug print
 		LogPrintf("Difficulty Retarget - KGW Wormhole\n");
-		LogPrintf("PastRateAdjustmentRatio = %g\n", PastRateAdjustmentRatio);
-		LogPrintf("Before: %08x  %s\n", BlockLastSolved->nBits, CBigNum().SetCompact(BlockLastSolved->nBits).getuint256().ToString().c_str());
-		LogPrintf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
+		LogPrintf("PastRateAdjustmentRatio = %g\n", window.PastRateAdjustmentRatio);
+		LogPrintf("Before: %08x  %s\n", BlockLastSolved->nBits, arith_uint256().SetCompact(BlockLastSolved->nBits).ToString().c_str());
+		LogPrintf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString().c_str());
     }
 	
     return bnNew.GetCompact();
@@ -247,7 +342,7 @@ unsigned int static DigiShield(const CBlockIndex* pindexLast, const CBlockHeader
     /// debug print
     LogPrintf("DigiShield RETARGET \n");
     LogPrintf("retargetTimespan = %g    nActualTimespan = %g \n", retargetTimespan, nActualTimespan);
-    LogPrintf("Before: %08x  %s\n", pindexLast->nBits, CBigNum().SetCompact(pindexLast->nBits).getuint256().ToString().c_str());
+    LogPrintf("Before: %08x  %s\n", pindexLast->nBits, arith_uint256().SetCompact(pindexLast->nBits).ToString().c_str());
     LogPrintf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.ToString().c_str());
 
     if (bnNew > bnProofOfWorkLimit)
@@ -256,21 +351,14 @@ unsigned int static DigiShield(const CBlockIndex* pindexLast, const CBlockHeader
     return bnNew.GetCompact();
 }
 
+/** DUAL_KGW3 eases the target of a block this many seconds after its parent. */
+static const int64_t DUAL_KGW3_LONG_TIME_LIMIT = 60 * 60; //mooncoin: 60 minutes
+
 unsigned int static DUAL_KGW3(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params) {
 
     // current difficulty formula, ERC3 - DUAL_KGW3, written by Christian Knoepke - apfelbaum@email.de
     const CBlockIndex *BlockLastSolved = pindexLast;
-    const CBlockIndex *BlockReading = pindexLast;
-    bool kgwdebug=true;
-    int64_t PastBlocksMass = 0;
-    int64_t PastRateActualSeconds = 0;
-    int64_t PastRateTargetSeconds = 0;
-    double PastRateAdjustmentRatio = double(1);
-    arith_uint256 PastDifficultyAverage;
-    arith_uint256 PastDifficultyAveragePrev;
-    double EventHorizonDeviation;
-    double EventHorizonDeviationFast;
-    double EventHorizonDeviationSlow;
+    bool kgwdebug=LogAcceptCategory("kgw");
 	
     //DUAL_KGW3 SETUP
     static const int64_t Blocktime = 90;
@@ -286,35 +374,11 @@ unsigned int static DUAL_KGW3(const CBlockIndex* pindexLast, const CBlockHeader
         return bnPowLimit.GetCompact(); 
     }
 
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
-        if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
-        PastBlocksMass++;
-        PastDifficultyAverage.SetCompact(BlockReading->nBits);
-        if (i > 1) {
-            if(PastDifficultyAverage >= PastDifficultyAveragePrev)
-                PastDifficultyAverage = ((PastDifficultyAverage - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev;
-            else
-                PastDifficultyAverage = PastDifficultyAveragePrev - ((PastDifficultyAveragePrev - PastDifficultyAverage) / i);
-        }
-        PastDifficultyAveragePrev = PastDifficultyAverage;
-        PastRateActualSeconds = BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
-        PastRateTargetSeconds = Blocktime * PastBlocksMass;
-        PastRateAdjustmentRatio = double(1);
-        if (PastRateActualSeconds < 0) { PastRateActualSeconds = 0; }
-        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
-            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
-        }
-        EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass)/double(72)), -1.228));  //28.2 and 144 possible
-        EventHorizonDeviationFast = EventHorizonDeviation;
-        EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
-
-        if (PastBlocksMass >= PastBlocksMin) {
-                if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast))
-                { assert(BlockReading); break; }
-        }
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
-    }
+    KGWWindow window;
+    GetKGWWindow(KGW_DUAL3, pindexLast, Blocktime, PastBlocksMin, PastBlocksMax, 72, window);  //28.2 and 144 possible
+    const arith_uint256& PastDifficultyAverage = window.PastDifficultyAverage;
+    const int64_t PastRateActualSeconds = window.PastRateActualSeconds;
+    const int64_t PastRateTargetSeconds = window.PastRateTargetSeconds;
 	
     //KGW Original
     arith_uint256 kgw_dual1(PastDifficultyAverage);
@@ -352,9 +416,9 @@ unsigned int static DUAL_KGW3(const CBlockIndex* pindexLast, const CBlockHeader
     }
 
     //BitBreak BitSend
-    const int nLongTimeLimit = 60 * 60; //mooncoin: 60 minutes
+    const int64_t nLongTimeLimit = DUAL_KGW3_LONG_TIME_LIMIT;
     if(kgwdebug){
-	LogPrintf("BLOCK %d (max: %d) PREDIFF %08x %s\n", BlockReading->nHeight, nLongTimeLimit, bnNew.GetCompact(), bnNew.ToString().c_str());
+	LogPrintf("BLOCK %d (max: %d) PREDIFF %08x %s\n", window.nHeightReading, nLongTimeLimit, bnNew.GetCompact(), bnNew.ToString().c_str());
     }
 
     // Reduce difficulty if current block generation time has already exceeded maximum time limit.
@@ -373,7 +437,7 @@ unsigned int static DUAL_KGW3(const CBlockIndex* pindexLast, const CBlockHeader
     return bnNew.GetCompact();
 }
 
-unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+static int GetDiffMode(const CBlockIndex* pindexLast)
 {
    int DiffMode = 1;
    int AlgoSmoothingPeriod = 8;
@@ -389,6 +453,25 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
    if (pindexLast->nHeight+1 >= AlgoForkHeight + AlgoSmoothingPeriod) { 
        DiffMode = 5;
    }
+   return DiffMode;
+}
+
+/**
+ * The only way pblock affects the next target: whether its timestamp is past
+ * the threshold of the testnet min-difficulty rule (V1) or of the maximum
+ * block time rule (DUAL_KGW3).
+ */
+static bool IsLateBlock(int DiffMode, const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+{
+   if (DiffMode == 1 && params.fPowAllowMinDifficultyBlocks)
+       return pblock->GetBlockTime() > pindexLast->GetBlockTime() + params.nPowTargetSpacing*2;
+   if (DiffMode == 5)
+       return (pblock->nTime - pindexLast->GetBlockTime()) > DUAL_KGW3_LONG_TIME_LIMIT;
+   return false;
+}
+
+static unsigned int ComputeNextWorkRequired(int DiffMode, const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+{
    //actions
    if (DiffMode == 1) { return GetNextWorkRequired_V1(pindexLast, pblock, params); }
    if (DiffMode == 2) { return GetNextWorkRequired_V2(pindexLast, pblock, params); }
@@ -398,6 +481,33 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
    return DUAL_KGW3(pindexLast, pblock, params); 
 }
 
+/**
+ * Templates are rebuilt many times on the same tip (getblocktemplate polling,
+ * the internal miner) and only the late-block regime of the new block can
+ * change the answer there. Keep one result per regime until the tip changes.
+ */
+static CCriticalSection cs_workcache;
+static uint256 hashWorkCacheTip;
+static unsigned int nWorkCache[2];
+static bool fWorkCacheValid[2] = { false, false };
+
+unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+{
+   const int DiffMode = GetDiffMode(pindexLast);
+   const int nRegime = IsLateBlock(DiffMode, pindexLast, pblock, params) ? 1 : 0;
+
+   LOCK(cs_workcache);
+   if (hashWorkCacheTip != pindexLast->GetBlockHash()) {
+       hashWorkCacheTip = pindexLast->GetBlockHash();
+       fWorkCacheValid[0] = fWorkCacheValid[1] = false;
+   }
+   if (!fWorkCacheValid[nRegime]) {
+       nWorkCache[nRegime] = ComputeNextWorkRequired(DiffMode, pindexLast, pblock, params);
+       fWorkCacheValid[nRegime] = true;
+   }
+   return nWorkCache[nRegime];
+}
+
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params& params, bool beGentle)
 {
     bool fNegative;
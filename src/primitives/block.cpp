@@ -54,3 +54,20 @@ int64_t GetBlockWeight(const CBlock& block)
     // weight = (stripped_size * 3) + total_size.
     return ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * (WITNESS_SCALE_FACTOR - 1) + ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
 }
+
+void GetPoWHashes(const CBlockHeader* pheaders, uint256* phashes, size_t nCount)
+{
+    // The 80 header bytes are contiguous from nVersion on, as GetPoWHash assumes.
+    std::vector<char> input(nCount * 80);
+    for (size_t i = 0; i < nCount; i++)
+        memcpy(&input[i * 80], BEGIN(pheaders[i].nVersion), 80);
+    if (nCount > 0)
+        scrypt_1024_1_1_256_batch(&input[0], BEGIN(phashes[0]), nCount);
+}
+
+void GetPoWHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashes)
+{
+    hashes.resize(headers.size());
+    if (!headers.empty())
+        GetPoWHashes(&headers[0], &hashes[0], headers.size());
+}
@@ -160,4 +160,8 @@ struct CBlockLocator
 /** Compute the consensus-critical block weight (see BIP 141). */
 int64_t GetBlockWeight(const CBlock& tx);
 
+/** Compute CBlockHeader::GetPoWHash for many headers at once, hashing them in SIMD lanes where possible. */
+void GetPoWHashes(const CBlockHeader* pheaders, uint256* phashes, size_t nCount);
+void GetPoWHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashes);
+
 #endif // BITCOIN_PRIMITIVES_BLOCK_H
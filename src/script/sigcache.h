@@ -11,8 +11,13 @@
 #include <vector>
 
 // DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// entries on 64-bit systems), shared with the script execution cache.
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Maximum -maxsigcachesize, in MiB
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
+/** Bytes each of the signature and script execution caches may use: half of -maxsigcachesize, clamped to [0, MAX_MAX_SIG_CACHE_SIZE] */
+size_t GetSigCacheBytes();
 
 class CPubKey;
 
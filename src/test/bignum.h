@@ -0,0 +1,213 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Nautiluscoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEST_BIGNUM_H
+#define BITCOIN_TEST_BIGNUM_H
+
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+
+#include <openssl/bn.h>
+
+/**
+ * The part of the CBigNum class difficulty retargeting used before it moved
+ * to arith_uint256, kept so the tests can run the old code next to the new.
+ * The arithmetic is OpenSSL's, as it was then. Unlike the original it holds a
+ * BIGNUM pointer, since the struct is opaque from OpenSSL 1.1 on.
+ */
+class bignum_error : public std::runtime_error
+{
+public:
+    explicit bignum_error(const std::string& str) : std::runtime_error(str) {}
+};
+
+/** RAII encapsulated BN_CTX (OpenSSL bignum context) */
+class CAutoBN_CTX
+{
+protected:
+    BN_CTX* pctx;
+
+public:
+    CAutoBN_CTX()
+    {
+        pctx = BN_CTX_new();
+        if (pctx == NULL)
+            throw bignum_error("CAutoBN_CTX : BN_CTX_new() returned NULL");
+    }
+
+    ~CAutoBN_CTX()
+    {
+        if (pctx != NULL)
+            BN_CTX_free(pctx);
+    }
+
+    operator BN_CTX*() { return pctx; }
+};
+
+/** C++ wrapper for BIGNUM (OpenSSL bignum) */
+class CBigNum
+{
+    BIGNUM* bn;
+
+    void init()
+    {
+        bn = BN_new();
+        if (bn == NULL)
+            throw bignum_error("CBigNum : BN_new failed");
+    }
+
+public:
+    CBigNum()
+    {
+        init();
+    }
+
+    CBigNum(const CBigNum& b)
+    {
+        init();
+        if (!BN_copy(bn, b.bn))
+        {
+            BN_clear_free(bn);
+            throw bignum_error("CBigNum::CBigNum(const CBigNum&) : BN_copy failed");
+        }
+    }
+
+    CBigNum& operator=(const CBigNum& b)
+    {
+        if (!BN_copy(bn, b.bn))
+            throw bignum_error("CBigNum::operator= : BN_copy failed");
+        return (*this);
+    }
+
+    ~CBigNum()
+    {
+        BN_clear_free(bn);
+    }
+
+    CBigNum(int n)                { init(); setint64(n); }
+    CBigNum(long n)               { init(); setint64(n); }
+    CBigNum(long long n)          { init(); setint64(n); }
+    CBigNum(unsigned int n)       { init(); setuint64(n); }
+    CBigNum(unsigned long n)      { init(); setuint64(n); }
+    CBigNum(unsigned long long n) { init(); setuint64(n); }
+
+    BIGNUM* get() { return bn; }
+    const BIGNUM* get() const { return bn; }
+
+    void setuint64(uint64_t n)
+    {
+        if (!BN_set_word(bn, n))
+            throw bignum_error("CBigNum conversion from uint64_t : BN_set_word failed");
+    }
+
+    void setint64(int64_t sn)
+    {
+        // Negating the unsigned value keeps the minimum representable.
+        setuint64(sn < 0 ? -(uint64_t)sn : (uint64_t)sn);
+        BN_set_negative(bn, sn < 0);
+    }
+
+    // The "compact" format is a representation of a whole
+    // number N using an unsigned 32bit number similar to a
+    // floating point format.
+    // The most significant 8 bits are the unsigned exponent of base 256.
+    // This exponent can be thought of as "number of bytes of N".
+    // The lower 23 bits are the mantissa.
+    // Bit number 24 (0x800000) represents the sign of N.
+    // N = (-1^sign) * mantissa * 256^(exponent-3)
+    CBigNum& SetCompact(unsigned int nCompact)
+    {
+        unsigned int nSize = nCompact >> 24;
+        bool fNegative     =(nCompact & 0x00800000) != 0;
+        unsigned int nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8*(3-nSize);
+            BN_set_word(bn, nWord);
+        }
+        else
+        {
+            BN_set_word(bn, nWord);
+            BN_lshift(bn, bn, 8*(nSize-3));
+        }
+        BN_set_negative(bn, fNegative);
+        return *this;
+    }
+
+    unsigned int GetCompact() const
+    {
+        unsigned int nSize = BN_num_bytes(bn);
+        unsigned int nCompact = 0;
+        if (nSize <= 3)
+            nCompact = BN_get_word(bn) << 8*(3-nSize);
+        else
+        {
+            CBigNum bnShifted;
+            BN_rshift(bnShifted.bn, bn, 8*(nSize-3));
+            nCompact = BN_get_word(bnShifted.bn);
+        }
+        // The 0x00800000 bit denotes the sign.
+        // Thus, if it is already set, divide the mantissa by 256 and increase the exponent.
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        nCompact |= (BN_is_negative(bn) ? 0x00800000 : 0);
+        return nCompact;
+    }
+
+    CBigNum& operator*=(const CBigNum& b)
+    {
+        CAutoBN_CTX pctx;
+        if (!BN_mul(bn, bn, b.bn, pctx))
+            throw bignum_error("CBigNum::operator*= : BN_mul failed");
+        return *this;
+    }
+
+    CBigNum& operator/=(const CBigNum& b);
+};
+
+inline const CBigNum operator+(const CBigNum& a, const CBigNum& b)
+{
+    CBigNum r;
+    if (!BN_add(r.get(), a.get(), b.get()))
+        throw bignum_error("CBigNum::operator+ : BN_add failed");
+    return r;
+}
+
+inline const CBigNum operator-(const CBigNum& a, const CBigNum& b)
+{
+    CBigNum r;
+    if (!BN_sub(r.get(), a.get(), b.get()))
+        throw bignum_error("CBigNum::operator- : BN_sub failed");
+    return r;
+}
+
+inline const CBigNum operator/(const CBigNum& a, const CBigNum& b)
+{
+    CAutoBN_CTX pctx;
+    CBigNum r;
+    if (!BN_div(r.get(), NULL, a.get(), b.get(), pctx))
+        throw bignum_error("CBigNum::operator/ : BN_div failed");
+    return r;
+}
+
+inline CBigNum& CBigNum::operator/=(const CBigNum& b)
+{
+    *this = *this / b;
+    return *this;
+}
+
+inline bool operator==(const CBigNum& a, const CBigNum& b) { return (BN_cmp(a.get(), b.get()) == 0); }
+inline bool operator!=(const CBigNum& a, const CBigNum& b) { return (BN_cmp(a.get(), b.get()) != 0); }
+inline bool operator<=(const CBigNum& a, const CBigNum& b) { return (BN_cmp(a.get(), b.get()) <= 0); }
+inline bool operator>=(const CBigNum& a, const CBigNum& b) { return (BN_cmp(a.get(), b.get()) >= 0); }
+inline bool operator<(const CBigNum& a, const CBigNum& b)  { return (BN_cmp(a.get(), b.get()) < 0); }
+inline bool operator>(const CBigNum& a, const CBigNum& b)  { return (BN_cmp(a.get(), b.get()) > 0); }
+
+#endif // BITCOIN_TEST_BIGNUM_H
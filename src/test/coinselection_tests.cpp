@@ -0,0 +1,63 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "amount.h"
+#include "test/test_bitcoin.h"
+#include "wallet/coinselection.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinselection_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(bnb_search)
+{
+    std::vector<CAmount> vValues;
+    std::vector<size_t> vSelected;
+    CAmount nValueRet;
+
+    // values must be sorted largest first
+    vValues.push_back(5 * CENT);
+    vValues.push_back(4 * CENT);
+    vValues.push_back(3 * CENT);
+    vValues.push_back(2 * CENT);
+    vValues.push_back(1 * CENT);
+
+    // exact matches
+    BOOST_CHECK(SelectCoinsBnB(vValues, 1 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 1 * CENT);
+    BOOST_CHECK_EQUAL(vSelected.size(), 1U);
+    BOOST_CHECK(SelectCoinsBnB(vValues, 10 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 10 * CENT);
+    BOOST_CHECK(SelectCoinsBnB(vValues, 15 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 15 * CENT);
+    BOOST_CHECK_EQUAL(vSelected.size(), 5U);
+
+    // not enough, or nothing within the window
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 16 * CENT, 0, vSelected, nValueRet));
+    BOOST_CHECK(vSelected.empty());
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 15 * CENT + 1, CENT - 2, vSelected, nValueRet));
+
+    // the closest subset within the window wins
+    vValues.clear();
+    vValues.push_back(7 * CENT);
+    vValues.push_back(6 * CENT);
+    vValues.push_back(3 * CENT);
+    BOOST_CHECK(SelectCoinsBnB(vValues, 8 * CENT, 2 * CENT, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 9 * CENT);
+
+    // a search cut short returns the best subset found so far, if any
+    BOOST_CHECK(SelectCoinsBnB(vValues, 8 * CENT, 2 * CENT, vSelected, nValueRet, 5));
+    BOOST_CHECK_EQUAL(nValueRet, 10 * CENT);
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 8 * CENT, 2 * CENT, vSelected, nValueRet, 4));
+
+    // equal values don't multiply the branches to search
+    vValues.assign(100000, 1 * CENT);
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 5 * CENT + CENT / 2, CENT / 4, vSelected, nValueRet));
+    BOOST_CHECK(SelectCoinsBnB(vValues, 5 * CENT - CENT / 2, CENT / 2, vSelected, nValueRet));
+    BOOST_CHECK_EQUAL(vSelected.size(), 5U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
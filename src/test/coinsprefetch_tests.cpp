@@ -0,0 +1,218 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+#include "utiltime.h"
+
+#include <map>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+
+/**
+ * In-memory CCoinsView whose BatchWrite can be held in the middle of a write,
+ * after it was entered and before the coins change. Reads go on meanwhile,
+ * as they do against the database.
+ */
+class CCoinsViewHeld : public CCoinsView
+{
+private:
+    mutable boost::mutex mutex;
+    mutable boost::condition_variable cond;
+    std::map<COutPoint, Coin> mapCoins;
+    mutable std::set<COutPoint> setRead;
+    bool fHold;
+    bool fWriting;
+
+public:
+    CCoinsViewHeld() : fHold(false), fWriting(false) {}
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        mapCoins[outpoint] = coin;
+    }
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        setRead.insert(outpoint);
+        cond.notify_all();
+        std::map<COutPoint, Coin>::const_iterator it = mapCoins.find(outpoint);
+        if (it == mapCoins.end())
+            return false;
+        coin = it->second;
+        return true;
+    }
+
+    bool HaveCoin(const COutPoint& outpoint) const
+    {
+        Coin coin;
+        return GetCoin(outpoint, coin);
+    }
+
+    bool BatchWrite(CCoinsMap& mapCoinsIn, const uint256& hashBlock)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fWriting = true;
+        cond.notify_all();
+        while (fHold)
+            cond.wait(lock);
+        for (CCoinsMap::iterator it = mapCoinsIn.begin(); it != mapCoinsIn.end(); ++it) {
+            if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+                continue;
+            if (it->second.coin.IsSpent())
+                mapCoins.erase(it->first);
+            else
+                mapCoins[it->first] = it->second.coin;
+        }
+        fWriting = false;
+        return true;
+    }
+
+    void Hold()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fHold = true;
+    }
+
+    void Release()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fHold = false;
+        cond.notify_all();
+    }
+
+    void WaitWriting() const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fWriting)
+            cond.wait(lock);
+    }
+
+    bool WasRead(const COutPoint& outpoint) const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return setRead.count(outpoint);
+    }
+
+    void WaitRead(const COutPoint& outpoint) const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!setRead.count(outpoint))
+            cond.wait(lock);
+    }
+};
+
+CBlock BlockSpending(const COutPoint& outpoint)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = outpoint;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    CBlock block;
+    block.vtx.push_back(CTransaction(tx));
+    return block;
+}
+
+Coin MakeCoin(CAmount nValue)
+{
+    return Coin(CTxOut(nValue, CScript() << OP_TRUE), 1, false);
+}
+
+/** Prefetch does nothing until a worker runs, so queue reads until one is served. */
+void WaitForWorker(CCoinsViewPrefetch& prefetch, const CCoinsViewHeld& base, const CCoinsViewCache& cache)
+{
+    const COutPoint outpoint(uint256S("ff"), 0);
+    while (!base.WasRead(outpoint)) {
+        prefetch.Prefetch(BlockSpending(outpoint), cache);
+        MilliSleep(1);
+    }
+}
+
+bool CallBatchWrite(CCoinsView* view, CCoinsMap* mapCoins)
+{
+    return view->BatchWrite(*mapCoins, uint256());
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(coinsprefetch_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(prefetch_stages_coins)
+{
+    CCoinsViewHeld base;
+    const COutPoint outpoint(uint256S("01"), 0);
+    base.AddCoin(outpoint, MakeCoin(50));
+
+    CCoinsViewPrefetch prefetch(&base, 1 << 20);
+    boost::thread worker(boost::bind(&CCoinsViewPrefetch::ThreadPrefetch, &prefetch));
+    CCoinsViewCache cache(&prefetch);
+    WaitForWorker(prefetch, base, cache);
+
+    // A second block after the first, so that once its input is read the
+    // worker is done with the first.
+    const COutPoint sentinel(uint256S("02"), 0);
+    prefetch.Prefetch(BlockSpending(outpoint), cache);
+    prefetch.Prefetch(BlockSpending(sentinel), cache);
+    base.WaitRead(sentinel);
+
+    // Staged coins are still served once the base view no longer has them.
+    base.AddCoin(outpoint, Coin());
+    Coin coin;
+    BOOST_CHECK(prefetch.GetCoin(outpoint, coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 50);
+
+    worker.interrupt();
+    worker.join();
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_drops_reads_during_write)
+{
+    CCoinsViewHeld base;
+    const COutPoint outpoint(uint256S("01"), 0);
+    base.AddCoin(outpoint, MakeCoin(50));
+
+    CCoinsViewPrefetch prefetch(&base, 1 << 20);
+    boost::thread worker(boost::bind(&CCoinsViewPrefetch::ThreadPrefetch, &prefetch));
+    CCoinsViewCache cache(&prefetch);
+    WaitForWorker(prefetch, base, cache);
+
+    // Spend the coin, and hold the write before the base view changes.
+    CCoinsMap mapCoins;
+    CCoinsCacheEntry& entry = mapCoins[outpoint];
+    entry.flags = CCoinsCacheEntry::DIRTY;
+    base.Hold();
+    boost::thread writer(boost::bind(&CallBatchWrite, &prefetch, &mapCoins));
+    base.WaitWriting();
+
+    // The worker takes the batch while the write is in progress and reads
+    // the coin as it was before.
+    const COutPoint sentinel(uint256S("02"), 0);
+    prefetch.Prefetch(BlockSpending(outpoint), cache);
+    prefetch.Prefetch(BlockSpending(sentinel), cache);
+    base.WaitRead(sentinel);
+
+    base.Release();
+    writer.join();
+
+    Coin coin;
+    BOOST_CHECK(!prefetch.GetCoin(outpoint, coin));
+    BOOST_CHECK(!prefetch.HaveCoin(outpoint));
+
+    worker.interrupt();
+    worker.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
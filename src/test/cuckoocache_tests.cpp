@@ -0,0 +1,145 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/common.h"
+#include "cuckoocache.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+
+/** A random entry whose two candidate buckets are both bucket nBucket */
+uint256 EntryInBucket(const CCuckooCache& cache, uint32_t nBucket)
+{
+    uint64_t nBuckets = cache.capacity() / CCuckooCache::SLOTS_PER_BUCKET;
+    uint32_t nHash = (((uint64_t)nBucket << 32) + nBuckets - 1) / nBuckets;
+    uint256 entry = GetRandHash();
+    WriteLE64(entry.begin(), ((uint64_t)nHash << 32) | nHash);
+    return entry;
+}
+
+void ReadEntries(CCuckooCache* cache, const std::vector<uint256>* vPresent, const std::vector<uint256>* vAbsent,
+                 std::atomic<int>* nMissing, std::atomic<int>* nFalsePositives)
+{
+    for (int nRound = 0; nRound < 200; nRound++) {
+        for (size_t i = 0; i < vPresent->size(); i++)
+            if (!cache->contains((*vPresent)[i], false))
+                ++*nMissing;
+        for (size_t i = 0; i < vAbsent->size(); i++)
+            if (cache->contains((*vAbsent)[i], false))
+                ++*nFalsePositives;
+    }
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_insert_contains)
+{
+    CCuckooCache cache(1 << 16);
+    BOOST_CHECK(cache.capacity() > 0);
+    BOOST_CHECK(cache.capacity() <= (1 << 16) / sizeof(uint256));
+
+    std::vector<uint256> vEntries;
+    for (int i = 0; i < 100; i++) {
+        vEntries.push_back(GetRandHash());
+        cache.insert(vEntries.back());
+    }
+    for (size_t i = 0; i < vEntries.size(); i++)
+        BOOST_CHECK(cache.contains(vEntries[i], false));
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(!cache.contains(GetRandHash(), false));
+
+    // Inserting an entry twice stores it once, so one erase removes it.
+    cache.insert(vEntries[0]);
+    BOOST_CHECK(cache.contains(vEntries[0], true));
+    BOOST_CHECK(!cache.contains(vEntries[0], false));
+    for (size_t i = 1; i < vEntries.size(); i++)
+        BOOST_CHECK(cache.contains(vEntries[i], false));
+
+    // A cache too small for one bucket holds nothing.
+    CCuckooCache empty(0);
+    BOOST_CHECK_EQUAL(empty.capacity(), 0U);
+    empty.insert(vEntries[0]);
+    BOOST_CHECK(!empty.contains(vEntries[0], false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_eviction)
+{
+    CCuckooCache cache(1 << 12);
+    BOOST_REQUIRE(cache.capacity() >= (size_t)CCuckooCache::SLOTS_PER_BUCKET);
+
+    // Entries that share one bucket fill it, then each new one replaces an
+    // old one.
+    std::vector<uint256> vSame;
+    for (int i = 0; i < 10; i++) {
+        vSame.push_back(EntryInBucket(cache, 0));
+        cache.insert(vSame.back());
+        BOOST_CHECK(cache.contains(vSame.back(), false));
+        int nFound = 0;
+        for (size_t j = 0; j < vSame.size(); j++)
+            nFound += cache.contains(vSame[j], false);
+        BOOST_CHECK_EQUAL(nFound, std::min(i + 1, (int)CCuckooCache::SLOTS_PER_BUCKET));
+    }
+
+    // Far more entries than fit: the newest is always found and the cache
+    // never holds more than its capacity.
+    std::vector<uint256> vEntries;
+    for (size_t i = 0; i < cache.capacity() * 10; i++) {
+        vEntries.push_back(GetRandHash());
+        cache.insert(vEntries.back());
+        BOOST_CHECK(cache.contains(vEntries.back(), false));
+    }
+    size_t nFound = 0;
+    for (size_t i = 0; i < vEntries.size(); i++)
+        nFound += cache.contains(vEntries[i], false);
+    BOOST_CHECK(nFound > 0);
+    BOOST_CHECK(nFound <= cache.capacity());
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_concurrent_readers)
+{
+    CCuckooCache cache(1 << 16);
+    uint32_t nBuckets = cache.capacity() / CCuckooCache::SLOTS_PER_BUCKET;
+    BOOST_REQUIRE(nBuckets >= 256);
+
+    // Entries the readers look for live in the first half of the table and
+    // the writer's in the second, so no write can evict them.
+    std::vector<uint256> vPresent, vAbsent, vWritten;
+    for (uint32_t i = 0; i < 128; i++) {
+        vPresent.push_back(EntryInBucket(cache, i));
+        cache.insert(vPresent.back());
+        vAbsent.push_back(EntryInBucket(cache, i));
+        vWritten.push_back(EntryInBucket(cache, nBuckets / 2 + i));
+    }
+
+    std::atomic<int> nMissing(0), nFalsePositives(0);
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(ReadEntries, &cache, &vPresent, &vAbsent, &nMissing, &nFalsePositives));
+    for (int nRound = 0; nRound < 200; nRound++) {
+        for (size_t i = 0; i < vWritten.size(); i++)
+            cache.insert(vWritten[i]);
+        for (size_t i = 0; i < vWritten.size(); i++)
+            cache.contains(vWritten[i], true);
+    }
+    threads.join_all();
+
+    BOOST_CHECK_EQUAL(nMissing.load(), 0);
+    BOOST_CHECK_EQUAL(nFalsePositives.load(), 0);
+    for (size_t i = 0; i < vWritten.size(); i++)
+        BOOST_CHECK(!cache.contains(vWritten[i], false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
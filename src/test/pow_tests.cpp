@@ -0,0 +1,317 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "random.h"
+#include "test/bignum.h"
+#include "test/test_bitcoin.h"
+#include "util.h"
+
+#include <math.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pow_tests, BasicTestingSetup)
+
+/*
+ * The retargeting code as it was before it moved from CBigNum to
+ * arith_uint256, with the logging dropped. GetNextWorkRequired must agree
+ * with it on every block.
+ */
+
+static unsigned int OldGetNextWorkRequired_V1(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+{
+    unsigned int nProofOfWorkLimit = UintToArith256(params.powLimit).GetCompact();
+
+    if ((pindexLast->nHeight+1) % params.DifficultyAdjustmentInterval() != 0)
+        return pindexLast->nBits;
+
+    int blockstogoback = params.DifficultyAdjustmentInterval()-1;
+    if ((pindexLast->nHeight+1) != params.DifficultyAdjustmentInterval())
+        blockstogoback = params.DifficultyAdjustmentInterval();
+
+    const CBlockIndex* pindexFirst = pindexLast;
+    for (int i = 0; pindexFirst && i < blockstogoback; i++)
+        pindexFirst = pindexFirst->pprev;
+    assert(pindexFirst);
+
+    int64_t nActualTimespan = pindexLast->GetBlockTime() - pindexFirst->GetBlockTime();
+    if (pindexLast->nHeight+1 > 10000) {
+        if (nActualTimespan < params.nPowTargetSpacing/4)
+            nActualTimespan = params.nPowTargetSpacing/4;
+        if (nActualTimespan > params.nPowTargetSpacing*4)
+            nActualTimespan = params.nPowTargetSpacing*4;
+    } else if (pindexLast->nHeight+1 > 5000) {
+        if (nActualTimespan < params.nPowTargetSpacing/8)
+            nActualTimespan = params.nPowTargetSpacing/8;
+        if (nActualTimespan > params.nPowTargetSpacing*4)
+            nActualTimespan = params.nPowTargetSpacing*4;
+    } else {
+        if (nActualTimespan < params.nPowTargetSpacing/16)
+            nActualTimespan = params.nPowTargetSpacing/16;
+        if (nActualTimespan > params.nPowTargetSpacing*4)
+            nActualTimespan = params.nPowTargetSpacing*4;
+    }
+
+    CBigNum bnNew;
+    bnNew.SetCompact(pindexLast->nBits);
+    bnNew *= nActualTimespan;
+    bnNew /= params.nPowTargetSpacing;
+
+    if (bnNew > nProofOfWorkLimit)
+        bnNew = nProofOfWorkLimit;
+
+    return bnNew.GetCompact();
+}
+
+static unsigned int OldKimotoGravityWell(const CBlockIndex* pindexLast, uint64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params)
+{
+    CBigNum bnProofOfWorkLimit = UintToArith256(params.powLimit).GetCompact();
+
+    const CBlockIndex *BlockLastSolved = pindexLast;
+    const CBlockIndex *BlockReading = pindexLast;
+    uint64_t PastBlocksMass = 0;
+    int64_t PastRateActualSeconds = 0;
+    int64_t PastRateTargetSeconds = 0;
+    double PastRateAdjustmentRatio = double(1);
+    CBigNum PastDifficultyAverage;
+    CBigNum PastDifficultyAveragePrev;
+    double EventHorizonDeviation;
+    double EventHorizonDeviationFast;
+    double EventHorizonDeviationSlow;
+
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || (uint64_t)BlockLastSolved->nHeight < PastBlocksMin) { return bnProofOfWorkLimit.GetCompact(); }
+
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
+        if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
+        PastBlocksMass++;
+
+        if (i == 1) { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
+        else        { PastDifficultyAverage = ((CBigNum().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev; }
+        PastDifficultyAveragePrev = PastDifficultyAverage;
+
+        PastRateActualSeconds = BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
+        PastRateTargetSeconds = TargetBlocksSpacingSeconds * PastBlocksMass;
+        PastRateAdjustmentRatio = double(1);
+        if (PastRateActualSeconds < 0) { PastRateActualSeconds = 0; }
+        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
+        }
+        EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
+        EventHorizonDeviationFast = EventHorizonDeviation;
+        EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
+
+        if (PastBlocksMass >= PastBlocksMin) {
+            if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast)) { assert(BlockReading); break; }
+        }
+        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
+        BlockReading = BlockReading->pprev;
+    }
+
+    CBigNum bnNew(PastDifficultyAverage);
+    if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+        bnNew *= PastRateActualSeconds;
+        bnNew /= PastRateTargetSeconds;
+    }
+    if (bnNew > bnProofOfWorkLimit) { bnNew = bnProofOfWorkLimit; }
+
+    return bnNew.GetCompact();
+}
+
+static unsigned int OldDUAL_KGW3(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+{
+    const CBlockIndex *BlockLastSolved = pindexLast;
+    const CBlockIndex *BlockReading = pindexLast;
+    int64_t PastBlocksMass = 0;
+    int64_t PastRateActualSeconds = 0;
+    int64_t PastRateTargetSeconds = 0;
+    double PastRateAdjustmentRatio = double(1);
+    arith_uint256 PastDifficultyAverage;
+    arith_uint256 PastDifficultyAveragePrev;
+    double EventHorizonDeviation;
+    double EventHorizonDeviationFast;
+    double EventHorizonDeviationSlow;
+
+    static const int64_t Blocktime = 90;
+    static const unsigned int timeDaySeconds = 86400;
+    int64_t pastSecondsMin = timeDaySeconds * 0.025;
+    int64_t pastSecondsMax = timeDaySeconds * 7;
+    int64_t PastBlocksMin = pastSecondsMin / Blocktime;
+    int64_t PastBlocksMax = pastSecondsMax / Blocktime;
+    const arith_uint256 bnPowLimit = UintToArith256(params.powLimit);
+
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 ||
+        (int64_t)BlockLastSolved->nHeight < PastBlocksMin) {
+        return bnPowLimit.GetCompact();
+    }
+
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
+        if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
+        PastBlocksMass++;
+        PastDifficultyAverage.SetCompact(BlockReading->nBits);
+        if (i > 1) {
+            if(PastDifficultyAverage >= PastDifficultyAveragePrev)
+                PastDifficultyAverage = ((PastDifficultyAverage - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev;
+            else
+                PastDifficultyAverage = PastDifficultyAveragePrev - ((PastDifficultyAveragePrev - PastDifficultyAverage) / i);
+        }
+        PastDifficultyAveragePrev = PastDifficultyAverage;
+        PastRateActualSeconds = BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
+        PastRateTargetSeconds = Blocktime * PastBlocksMass;
+        PastRateAdjustmentRatio = double(1);
+        if (PastRateActualSeconds < 0) { PastRateActualSeconds = 0; }
+        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
+        }
+        EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass)/double(72)), -1.228));
+        EventHorizonDeviationFast = EventHorizonDeviation;
+        EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
+
+        if (PastBlocksMass >= PastBlocksMin) {
+            if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast))
+            { assert(BlockReading); break; }
+        }
+        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
+        BlockReading = BlockReading->pprev;
+    }
+
+    arith_uint256 kgw_dual1(PastDifficultyAverage);
+    arith_uint256 kgw_dual2;
+    kgw_dual2.SetCompact(pindexLast->nBits);
+    if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+        kgw_dual1 *= PastRateActualSeconds;
+        kgw_dual1 /= PastRateTargetSeconds;
+    }
+    int64_t nActualTime1 = pindexLast->GetBlockTime() - pindexLast->pprev->GetBlockTime();
+    int64_t nActualTimespanshort = nActualTime1;
+
+    if(nActualTime1 < 0) { nActualTime1 = Blocktime; }
+
+    if (nActualTime1 < Blocktime / 3)
+        nActualTime1 = Blocktime / 3;
+    if (nActualTime1 > Blocktime * 3)
+        nActualTime1 = Blocktime * 3;
+    kgw_dual2 *= nActualTime1;
+    kgw_dual2 /= Blocktime;
+
+    arith_uint256 bnNew;
+    bnNew = ((kgw_dual2 + kgw_dual1)/2);
+
+    if(nActualTimespanshort < Blocktime/6){
+        const int nLongShortNew1 = 85;
+        const int nLongShortNew2 = 100;
+        bnNew = bnNew * nLongShortNew1;
+        bnNew = bnNew / nLongShortNew2;
+    }
+
+    const int nLongTimeLimit = 60 * 60;
+    if ((pblock-> nTime - pindexLast->GetBlockTime()) > nLongTimeLimit)
+        bnNew = bnPowLimit/15;
+
+    if (bnNew > bnPowLimit)
+        bnNew = bnPowLimit;
+
+    return bnNew.GetCompact();
+}
+
+/**
+ * A chain segment of nBlocks headers from nStartHeight on. Block times are
+ * random around the 90 second spacing, with runs of fast and slow blocks and
+ * the odd timestamp earlier than its parent's. Hashes are unique across all
+ * chains made, as the retarget caches are keyed by the tip hash.
+ */
+struct TestChain
+{
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vBlocks;
+
+    TestChain(int nStartHeight, int nBlocks, unsigned int nBits) : vHashes(nBlocks), vBlocks(nBlocks)
+    {
+        static uint64_t nNextHash = 1;
+        int64_t nTime = 1500000000;
+        for (int i = 0; i < nBlocks; i++) {
+            vHashes[i] = ArithToUint256(arith_uint256(nNextHash++) << 128);
+            CBlockIndex& block = vBlocks[i];
+            block.phashBlock = &vHashes[i];
+            block.pprev = i ? &vBlocks[i - 1] : NULL;
+            block.nHeight = nStartHeight + i;
+            block.nTime = nTime;
+            block.nBits = nBits;
+            nTime += NextSpacing(i);
+        }
+    }
+
+    static int64_t NextSpacing(int i)
+    {
+        switch ((i / 50) % 4) {
+        case 0: return 60 + insecure_rand() % 60;   // on target
+        case 1: return insecure_rand() % 20;        // hash rate spike
+        case 2: return 100 + insecure_rand() % 400; // hash rate drop
+        default: return (int64_t)(insecure_rand() % 300) - 60;
+        }
+    }
+
+    /** Set each block's nBits to what the new code requires of it, after checking the old code agrees. */
+    template <typename F>
+    void Replay(int nFirst, F oldNextWork, const Consensus::Params& params)
+    {
+        for (size_t i = nFirst; i < vBlocks.size(); i++) {
+            const CBlockIndex* pindexLast = &vBlocks[i - 1];
+            CBlockHeader header;
+            // On time, then late enough for the DUAL_KGW3 maximum block time rule
+            const int64_t vDelay[] = { 90, 3601 + insecure_rand() % 3600 };
+            for (unsigned int j = 0; j < 2; j++) {
+                header.nTime = pindexLast->GetBlockTime() + vDelay[j];
+                unsigned int nBitsOld = oldNextWork(pindexLast, &header, params);
+                unsigned int nBitsNew = GetNextWorkRequired(pindexLast, &header, params);
+                BOOST_CHECK_MESSAGE(nBitsOld == nBitsNew, strprintf("height %d delay %d: old %08x new %08x",
+                    pindexLast->nHeight + 1, vDelay[j], nBitsOld, nBitsNew));
+            }
+            header.nTime = vBlocks[i].nTime;
+            vBlocks[i].nBits = GetNextWorkRequired(pindexLast, &header, params);
+        }
+    }
+};
+
+static unsigned int OldGetNextWorkRequired_V2(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+{
+    return OldKimotoGravityWell(pindexLast, 90, 86400 / 4 / 90, 86400 * 7 / 90, params);
+}
+
+/*
+ * V1 and KGW cap the target at the compact encoding of the limit taken as a
+ * number, so only targets below 2^32 ever move. Those chains start there.
+ */
+static const unsigned int nBitsBelowCap = 0x04012345;
+
+BOOST_AUTO_TEST_CASE(retarget_v1_matches_bignum)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    seed_insecure_rand(true);
+    // Crosses the 5000 and 10000 height steps in the adjustment bounds.
+    TestChain chain(4000, 6500, nBitsBelowCap);
+    chain.Replay(400, OldGetNextWorkRequired_V1, params);
+}
+
+BOOST_AUTO_TEST_CASE(kimoto_gravity_well_matches_bignum)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    seed_insecure_rand(true);
+    TestChain chain(30000, 2000, nBitsBelowCap);
+    chain.Replay(1, OldGetNextWorkRequired_V2, params);
+}
+
+BOOST_AUTO_TEST_CASE(dual_kgw3_matches_long_division)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    seed_insecure_rand(true);
+    TestChain chain(AlgoForkHeight + 8, 2000, 0x1d00d86a);
+    chain.Replay(2, OldDUAL_KGW3, params);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,115 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/scrypt.h"
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(scrypt_tests, BasicTestingSetup)
+
+/* Litecoin block headers and their scrypt hashes */
+static const char* inputhex[] = {
+    "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659",
+    "0200000011503ee6a855e900c00cfdd98f5f55fffeaee9b6bf55bea9b852d9de2ce35828e204eef76acfd36949ae56d1fbe81c1ac9c0209e6331ad56414f9072506a77f8c6faf551eac7471b00389d01",
+    "02000000a72c8a177f523946f42f22c3e86b8023221b4105e8007e59e81f6beb013e29aaf635295cb9ac966213fb56e046dc71df5b3f7f67ceaeab24038e743f883aff1aaafaf551eac7471b0166249b",
+    "010000007824bc3a8a1b4628485eee3024abd8626721f7f870f8ad4d2f33a27155167f6a4009d1285049603888fe85a84b6c803a53305a8d497965a5e896e1a00568359589faf551eac7471b0065434e",
+    "0200000050bfd4e4a307a8cb6ef4aef69abc5c0f2d579648bd80d7733e1ccc3fbc90ed664a7f74006cb11bde87785f229ecd366c2d4e44432832580e0608c579e4cb76f383f7f551eac7471b00c36982",
+};
+static const char* expected[] = {
+    "00000000002bef4107f882f6115e0b01f348d21195dacd3582aa2dabd7985806",
+    "00000000003a0d11bdd5eb634e08b7feddcfbbf228ed35d250daf19f1c88fc94",
+    "00000000000b40f895f288e13244728a6c2d9d59d8aff29c65f8dd5114a8ca81",
+    "00000000003007005891cd4923031e99d8e8d72f6e8e7edc6a86181897e105fe",
+    "000000000018f0b426a4afc7130ccb47fa02af730d345b4fe7c7724d3800ec8c",
+};
+static const size_t HASHCOUNT = sizeof(expected) / sizeof(expected[0]);
+
+/* 80-byte inputs that differ in every word, so no two lanes hash alike */
+static std::vector<char> BatchInput(size_t nCount)
+{
+    std::vector<char> input(nCount * 80);
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = (char)(i * 131 + (i >> 7) * 17 + 1);
+    return input;
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_hashtest)
+{
+    scrypt_detect_cpu();
+
+    std::vector<char> input;
+    for (size_t i = 0; i < HASHCOUNT; i++) {
+        std::vector<unsigned char> header = ParseHex(inputhex[i]);
+        BOOST_REQUIRE_EQUAL(header.size(), 80U);
+        input.insert(input.end(), header.begin(), header.end());
+
+        uint256 hash;
+        scrypt_1024_1_1_256((const char*)&header[0], BEGIN(hash));
+        BOOST_CHECK_EQUAL(hash.ToString(), expected[i]);
+
+        char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+        scrypt_1024_1_1_256_sp_generic((const char*)&header[0], BEGIN(hash), scratchpad);
+        BOOST_CHECK_EQUAL(hash.ToString(), expected[i]);
+    }
+
+    // Replicate the vectors so that they fill whole lanes of every backend.
+    const size_t nCopies = 7;
+    for (size_t i = 1; i < nCopies; i++)
+        input.insert(input.end(), input.begin(), input.begin() + 80 * HASHCOUNT);
+    std::vector<uint256> hashes(HASHCOUNT * nCopies);
+    scrypt_1024_1_1_256_batch(&input[0], BEGIN(hashes[0]), hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++)
+        BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i % HASHCOUNT]);
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_batch_matches_single)
+{
+    // Whatever backends this CPU has, every count mixes lane groups and the
+    // one-at-a-time remainder differently.
+    BOOST_TEST_MESSAGE("scrypt implementation: " << scrypt_detect_cpu());
+
+    const size_t counts[] = {1, 3, 4, 7, 8, 15, 16, 17, 33};
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        size_t nCount = counts[c];
+        std::vector<char> input = BatchInput(nCount);
+        std::vector<uint256> hashes(nCount);
+        scrypt_1024_1_1_256_batch(&input[0], BEGIN(hashes[0]), nCount);
+        for (size_t i = 0; i < nCount; i++) {
+            uint256 hash;
+            scrypt_1024_1_1_256(&input[80 * i], BEGIN(hash));
+            BOOST_CHECK_MESSAGE(hashes[i] == hash, "batch of " << nCount << ", input " << i);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(getpowhashes_matches_scrypt)
+{
+    scrypt_detect_cpu();
+
+    std::vector<CBlockHeader> headers(17);
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].nVersion = 4;
+        headers[i].hashPrevBlock = uint256S("0xa1b2c3d4e5f60718293a4b5c6d7e8f90a1b2c3d4e5f60718293a4b5c6d7e8f90");
+        headers[i].hashMerkleRoot = uint256S("0x0f1e2d3c4b5a69788796a5b4c3d2e1f00f1e2d3c4b5a69788796a5b4c3d2e1f0");
+        headers[i].nTime = 1500000000 + i;
+        headers[i].nBits = 0x1e0ffff0;
+        headers[i].nNonce = i * 7919;
+    }
+    std::vector<uint256> hashes;
+    GetPoWHashes(headers, hashes);
+    BOOST_REQUIRE_EQUAL(hashes.size(), headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        uint256 hash;
+        scrypt_1024_1_1_256(BEGIN(headers[i].nVersion), BEGIN(hash));
+        BOOST_CHECK(hashes[i] == hash);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,130 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "amount.h"
+#include "main.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+
+/** The seed as GetBlockSubsidy used to compute it, by formatting prevHash */
+long OldSubsidySeed(const uint256& prevHash)
+{
+    std::string cseed_str = prevHash.ToString().substr(7, 7);
+    return hex2long(cseed_str.c_str());
+}
+
+int OldMTRandom(unsigned int s, int range)
+{
+    boost::random::mt19937 gen(s);
+    boost::uniform_int<> dist(1, range);
+    return dist(gen);
+}
+
+int NewMTRandom(unsigned int s, int range)
+{
+    CLazyMT19937 gen(s);
+    boost::uniform_int<> dist(1, range);
+    return dist(gen);
+}
+
+/**
+ * Previous block hashes, many with zeros in or right before the seed digits
+ * as real block hashes have, so that the seed string has leading zeros.
+ */
+std::vector<uint256> TestHashes()
+{
+    const char* hexes[] = {
+        "0000000000000000000000000000000000000000000000000000000000000000",
+        "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+        "bd043d1f3fd06fd18f1e5b9fb8d6e8dc2c2f3d5ab2e1ab1f6bd7a88e4c96a6d8",
+        "00000000002bef4107f882f6115e0b01f348d21195dacd3582aa2dabd7985806",
+        "00000000003a0d11bdd5eb634e08b7feddcfbbf228ed35d250daf19f1c88fc94",
+        "000000000018f0b426a4afc7130ccb47fa02af730d345b4fe7c7724d3800ec8c",
+        "000000000000000000000000000000000000000000000000000000000000abcd",
+        "0000000100000000000000000000000000000000000000000000000000000000",
+        "0000000000000100000000000000000000000000000000000000000000000000",
+        "000000f000000f00000000000000000000000000000000000000000000000000",
+        "ffffffff0000000fffffffffffffffffffffffffffffffffffffffffffffffff",
+        "fffffff80000001fffffffffffffffffffffffffffffffffffffffffffffffff",
+        "1234567089abcdef0123456789abcdef0123456789abcdef0123456789abcdef",
+        "12a05f200000000000000000000000000000000000000000000000000000000f",
+    };
+    std::vector<uint256> vHashes;
+    for (size_t i = 0; i < sizeof(hexes) / sizeof(hexes[0]); i++)
+        vHashes.push_back(uint256S(hexes[i]));
+    for (int i = 0; i < 500; i++)
+        vHashes.push_back(GetRandHash());
+    return vHashes;
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(subsidy_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(subsidy_seed_matches_hex_string)
+{
+    std::vector<uint256> vHashes = TestHashes();
+    for (size_t i = 0; i < vHashes.size(); i++)
+        BOOST_CHECK_MESSAGE(GetSubsidySeed(vHashes[i]) == (unsigned int)OldSubsidySeed(vHashes[i]), vHashes[i].ToString());
+
+    BOOST_CHECK_EQUAL(GetSubsidySeed(uint256()), 0U);
+    BOOST_CHECK_EQUAL(GetSubsidySeed(uint256S("0000000100000000000000000000000000000000000000000000000000000000")), 0x1000000U);
+    BOOST_CHECK_EQUAL(GetSubsidySeed(uint256S("0000000000000100000000000000000000000000000000000000000000000000")), 0x1U);
+    BOOST_CHECK_EQUAL(GetSubsidySeed(uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff")), 0xfffffffU);
+}
+
+BOOST_AUTO_TEST_CASE(lazy_mt19937_matches_boost)
+{
+    std::vector<uint256> vHashes = TestHashes();
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        unsigned int seed = GetSubsidySeed(vHashes[i]);
+        CLazyMT19937 lazy(seed);
+        boost::random::mt19937 gen(seed);
+        // Past the 227 outputs the lazy engine computes itself, so that
+        // the fallback to the full engine is covered too.
+        for (int k = 0; k < 240; k++)
+            BOOST_CHECK_EQUAL(lazy(), gen());
+    }
+
+    // Seeds that do not come from a hash, as generateMTRandom accepts any.
+    const uint32_t seeds[] = {0, 1, 5489, 0x7fffffff, 0x80000000, 0xffffffff};
+    for (size_t i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++) {
+        CLazyMT19937 lazy(seeds[i]);
+        boost::random::mt19937 gen(seeds[i]);
+        for (int k = 0; k < 240; k++)
+            BOOST_CHECK_EQUAL(lazy(), gen());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(subsidy_draws_match_boost)
+{
+    // Every range of the random-reward era, with the height that uses it.
+    const int ranges[] = {1999999, 999999, 599999, 349999, 174999, 99999, 49999};
+    const int heights[] = {1, 203300, 250000, 300000, 350000, 375000, 384400};
+    std::vector<uint256> vHashes = TestHashes();
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        long nOldSeed = OldSubsidySeed(vHashes[i]);
+        for (int r = 0; r < 7; r++) {
+            int nDraw = OldMTRandom(nOldSeed, ranges[r]);
+            BOOST_CHECK_EQUAL(NewMTRandom(GetSubsidySeed(vHashes[i]), ranges[r]), nDraw);
+            BOOST_CHECK_EQUAL(GetBlockSubsidy(heights[r], vHashes[i]), (1 + nDraw) * COIN);
+        }
+        // The lunar-cycle prize doubles the draw.
+        BOOST_CHECK_EQUAL(GetBlockSubsidy(29531, vHashes[i]), 2 * (1 + OldMTRandom(nOldSeed, 1999999)) * COIN);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,115 @@
+// Copyright (c) 2011-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#define BOOST_TEST_MODULE Mooncoin Test Suite
+
+#include "test_bitcoin.h"
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "main.h"
+#include "miner.h"
+#include "pow.h"
+#include "random.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
+{
+        ECC_Start();
+        SetupEnvironment();
+        fPrintToDebugLog = false; // don't want to write to debug.log file
+        SelectParams(chainName);
+}
+
+BasicTestingSetup::~BasicTestingSetup()
+{
+        ECC_Stop();
+}
+
+TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(chainName)
+{
+        const CChainParams& chainparams = Params();
+        ClearDatadirCache();
+        pathTemp = boost::filesystem::temp_directory_path() / strprintf("test_mooncoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        mempool.setSanityCheck(1.0);
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        InitBlockIndex(chainparams);
+        {
+            // Connect the genesis block the way ThreadImport does, which
+            // IsInitialBlockDownload() needs as there is no tip yet.
+            fImporting = true;
+            CValidationState state;
+            bool ok = ActivateBestChain(state, chainparams);
+            fImporting = false;
+            BOOST_CHECK(ok);
+        }
+}
+
+TestingSetup::~TestingSetup()
+{
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        pcoinsTip = NULL;
+        delete pcoinsdbview;
+        delete pblocktree;
+        pblocktree = NULL;
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathTemp);
+}
+
+TestChain100Setup::TestChain100Setup() : TestingSetup(CBaseChainParams::REGTEST)
+{
+    // Generate a 100-block chain:
+    coinbaseKey.MakeNewKey(true);
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 100; i++)
+    {
+        std::vector<CMutableTransaction> noTxns;
+        CBlock b = CreateAndProcessBlock(noTxns, scriptPubKey);
+        coinbaseTxns.push_back(b.vtx[0]);
+    }
+}
+
+//
+// Create a new block with just given transactions, coinbase paying to
+// scriptPubKey, and try to add it to the current chain.
+//
+CBlock
+TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey)
+{
+    const CChainParams& chainparams = Params();
+    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams).CreateNewBlock(scriptPubKey));
+    CBlock& block = pblocktemplate->block;
+
+    // Replace mempool-selected txns with just coinbase plus passed-in txns:
+    block.vtx.resize(1);
+    for (size_t i = 0; i < txns.size(); i++)
+        block.vtx.push_back(txns[i]);
+    // IncrementExtraNonce creates a valid coinbase and merkleRoot
+    unsigned int extraNonce = 0;
+    IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+
+    while (!CheckProofOfWork(block.GetPoWHash(false), block.nBits, chainparams.GetConsensus(), true)) ++block.nNonce;
+
+    CValidationState state;
+    ProcessNewBlock(state, chainparams, NULL, &block, true, NULL, false);
+
+    return block;
+}
+
+TestChain100Setup::~TestChain100Setup()
+{
+}
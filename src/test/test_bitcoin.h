@@ -0,0 +1,62 @@
+// Copyright (c) 2015-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEST_TEST_BITCOIN_H
+#define BITCOIN_TEST_TEST_BITCOIN_H
+
+#include "chainparamsbase.h"
+#include "key.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/** Basic testing setup.
+ * This just configures logging and chain parameters.
+ */
+struct BasicTestingSetup {
+    ECCVerifyHandle globalVerifyHandle;
+
+    BasicTestingSetup(const std::string& chainName = CBaseChainParams::MAIN);
+    ~BasicTestingSetup();
+};
+
+/** Testing setup that configures a complete environment.
+ * Included are data directory, coins database and block tree database,
+ * with the genesis block connected.
+ */
+class CCoinsViewDB;
+struct TestingSetup: public BasicTestingSetup {
+    CCoinsViewDB *pcoinsdbview;
+    boost::filesystem::path pathTemp;
+
+    TestingSetup(const std::string& chainName = CBaseChainParams::MAIN);
+    ~TestingSetup();
+};
+
+/**
+ * Testing fixture that pre-creates a 100-block regtest chain, each block
+ * paying its coinbase to coinbaseKey.
+ */
+struct TestChain100Setup : public TestingSetup {
+    TestChain100Setup();
+
+    /**
+     * Create a new block with just the given transactions, a coinbase
+     * paying to scriptPubKey, and try to add it to the current chain.
+     */
+    CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns,
+                                 const CScript& scriptPubKey);
+
+    ~TestChain100Setup();
+
+    std::vector<CTransaction> coinbaseTxns; // For convenience, coinbase transactions
+    CKey coinbaseKey; // private/public key needed to spend coinbase transactions
+};
+
+#endif
@@ -0,0 +1,152 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "keystore.h"
+#include "main.h"
+#include "miner.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "txmempool.h"
+
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+
+/**
+ * The outputs of the fixture's coinbases as of the tip they were mined up
+ * to, so that their spends can be checked after a block has spent them.
+ */
+struct CCoinbaseView
+{
+    CCoinsView base;
+    CCoinsViewCache view;
+
+    CCoinbaseView(const std::vector<CTransaction>& coinbaseTxns) : view(&base)
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < coinbaseTxns.size(); i++)
+            AddCoins(view, coinbaseTxns[i], i + 1);
+        view.SetBestBlock(chainActive.Tip()->GetBlockHash());
+    }
+};
+
+/**
+ * Whether the script execution cache holds tx under flags. Checks are
+ * deferred to vChecks and the cache is consulted without erasing, so this
+ * neither runs the scripts nor changes the cache.
+ */
+bool IsCached(const CCoinsViewCache& view, const CTransaction& tx, unsigned int flags)
+{
+    CValidationState state;
+    PrecomputedTransactionData txdata(tx);
+    std::vector<CScriptCheck> vChecks;
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, false, true, txdata, &vChecks));
+    return vChecks.empty();
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(txvalidationcache_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(scriptcache_mempool_hit_in_connectblock)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBasicKeyStore keystore;
+    keystore.AddKey(coinbaseKey);
+    CCoinbaseView coinbases(coinbaseTxns);
+
+    // Block 101 has neither DERSIG nor CHECKLOCKTIMEVERIFY active, so the
+    // mempool and ConnectBlock both check with just P2SH.
+    const unsigned int flags = SCRIPT_VERIFY_P2SH;
+
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(coinbaseTxns[0].GetHash(), 0)));
+    mtx.vout.push_back(CTxOut(coinbaseTxns[0].vout[0].nValue - COIN, scriptPubKey));
+    BOOST_REQUIRE(SignSignature(keystore, coinbaseTxns[0], mtx, 0, SIGHASH_ALL));
+    CTransaction tx(mtx);
+    BOOST_CHECK(!IsCached(coinbases.view, tx, flags));
+
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, tx, false, NULL));
+    }
+    BOOST_CHECK(IsCached(coinbases.view, tx, flags));
+    BOOST_CHECK(!IsCached(coinbases.view, tx, SCRIPT_VERIFY_NONE));
+    BOOST_CHECK(!IsCached(coinbases.view, tx, flags | SCRIPT_VERIFY_DERSIG));
+    BOOST_CHECK(!IsCached(coinbases.view, tx, flags | SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_NULLDUMMY));
+
+    // Checking a block with fJustCheck, as the miner does, consults the
+    // entry but keeps it.
+    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams).CreateNewBlock(scriptPubKey));
+    CBlock& block = pblocktemplate->block;
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 2U);
+    BOOST_CHECK(block.vtx[1].GetHash() == tx.GetHash());
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(TestBlockValidity(state, chainparams, block, chainActive.Tip(), false, false));
+    }
+    BOOST_CHECK(IsCached(coinbases.view, tx, flags));
+
+    // Connecting the block finds the entry under the same flags, which only
+    // a match erases.
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, mtx), scriptPubKey);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(coinbaseTxns[0].GetHash(), 0)));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(tx.GetHash(), 0)));
+    }
+    BOOST_CHECK(!IsCached(coinbases.view, tx, flags));
+}
+
+BOOST_AUTO_TEST_CASE(scriptcache_other_flags_do_not_match)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBasicKeyStore keystore;
+    keystore.AddKey(coinbaseKey);
+    CCoinbaseView coinbases(coinbaseTxns);
+
+    const unsigned int flags = SCRIPT_VERIFY_P2SH;
+    const unsigned int flagsOther = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(coinbaseTxns[1].GetHash(), 0)));
+    mtx.vout.push_back(CTxOut(coinbaseTxns[1].vout[0].nValue - COIN, scriptPubKey));
+    BOOST_REQUIRE(SignSignature(keystore, coinbaseTxns[1], mtx, 0, SIGHASH_ALL));
+    CTransaction tx(mtx);
+
+    // Store the transaction's result under stricter flags than block 101's.
+    {
+        CValidationState state;
+        PrecomputedTransactionData txdata(tx);
+        BOOST_REQUIRE(CheckInputs(tx, state, coinbases.view, true, flagsOther, true, true, txdata));
+    }
+    BOOST_CHECK(IsCached(coinbases.view, tx, flagsOther));
+    BOOST_CHECK(!IsCached(coinbases.view, tx, flags));
+
+    // ConnectBlock misses, runs the scripts and leaves the other entry be.
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, mtx), scriptPubKey);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(tx.GetHash(), 0)));
+    }
+    BOOST_CHECK(IsCached(coinbases.view, tx, flagsOther));
+    BOOST_CHECK(!IsCached(coinbases.view, tx, flags));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,238 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "core_io.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/ismine.h"
+#include "script/script.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+#include "wallet/wallet.h"
+#include "wallet/walletfilter.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+
+CKey NewKey(bool fCompressed)
+{
+    CKey key;
+    key.MakeNewKey(fCompressed);
+    return key;
+}
+
+/** The data pushed with OP_PUSHDATA1 or OP_PUSHDATA2, which a minimal push would not use */
+CScript NonMinimalPush(const std::vector<unsigned char>& vch, opcodetype opcode)
+{
+    CScript script;
+    script.push_back(opcode);
+    script.push_back(vch.size());
+    if (opcode == OP_PUSHDATA2)
+        script.push_back(0);
+    script.insert(script.end(), vch.begin(), vch.end());
+    return script;
+}
+
+/** Every script template IsMine knows about that pubkey may appear in, alone */
+void AddKeyScripts(std::vector<CScript>& vScripts, const CPubKey& pubkey)
+{
+    CKeyID keyID = pubkey.GetID();
+    std::vector<unsigned char> vchKey(pubkey.begin(), pubkey.end());
+    std::vector<unsigned char> vchKeyID(keyID.begin(), keyID.end());
+    CScript p2pkh = GetScriptForDestination(keyID);
+    CScript p2pk = GetScriptForRawPubKey(pubkey);
+    vScripts.push_back(p2pkh);
+    vScripts.push_back(p2pk);
+    vScripts.push_back(GetScriptForWitness(p2pkh));
+    vScripts.push_back(GetScriptForDestination(CScriptID(p2pkh)));
+    vScripts.push_back(GetScriptForDestination(CScriptID(GetScriptForWitness(p2pkh))));
+    vScripts.push_back(GetScriptForMultisig(1, std::vector<CPubKey>(1, pubkey)));
+    const opcodetype pushes[] = {OP_PUSHDATA1, OP_PUSHDATA2};
+    for (int i = 0; i < 2; i++) {
+        vScripts.push_back((CScript() << OP_DUP << OP_HASH160) + NonMinimalPush(vchKeyID, pushes[i]) + (CScript() << OP_EQUALVERIFY << OP_CHECKSIG));
+        vScripts.push_back(NonMinimalPush(vchKey, pushes[i]) + (CScript() << OP_CHECKSIG));
+    }
+}
+
+/** Check that the filtered CWallet::IsMine agrees with ::IsMine on every script; return how many are ours */
+int CheckIsMine(const CWallet& wallet, const std::vector<CScript>& vScripts)
+{
+    int nMine = 0;
+    for (size_t i = 0; i < vScripts.size(); i++) {
+        isminetype mine = ::IsMine(wallet, vScripts[i]);
+        BOOST_CHECK_MESSAGE(wallet.IsMine(CTxOut(0, vScripts[i])) == mine, "script " << i << ": " << ScriptToAsmStr(vScripts[i]));
+        if (mine != ISMINE_NO)
+            nMine++;
+    }
+    return nMine;
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(walletfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(maybemine_matches_ismine)
+{
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    CKey keyCompressed = NewKey(true), keyUncompressed = NewKey(false), keyMultisig = NewKey(true);
+    CKey keyOther = NewKey(true), keyWatch = NewKey(true);
+    BOOST_REQUIRE(wallet.AddKeyPubKey(keyCompressed, keyCompressed.GetPubKey()));
+    BOOST_REQUIRE(wallet.AddKeyPubKey(keyUncompressed, keyUncompressed.GetPubKey()));
+    BOOST_REQUIRE(wallet.AddKeyPubKey(keyMultisig, keyMultisig.GetPubKey()));
+
+    std::vector<CPubKey> vMultisig;
+    vMultisig.push_back(keyCompressed.GetPubKey());
+    vMultisig.push_back(keyMultisig.GetPubKey());
+    CScript multisig = GetScriptForMultisig(1, vMultisig);
+    std::vector<CPubKey> vOtherMultisig(1, keyOther.GetPubKey());
+    vOtherMultisig.push_back(keyWatch.GetPubKey());
+    CScript otherMultisig = GetScriptForMultisig(1, vOtherMultisig);
+
+    std::vector<CScript> vScripts;
+    AddKeyScripts(vScripts, keyCompressed.GetPubKey());
+    AddKeyScripts(vScripts, keyUncompressed.GetPubKey());
+    AddKeyScripts(vScripts, keyOther.GetPubKey());
+    AddKeyScripts(vScripts, keyWatch.GetPubKey());
+    const CScript scripts[] = {multisig, otherMultisig};
+    for (int i = 0; i < 2; i++) {
+        vScripts.push_back(scripts[i]);
+        vScripts.push_back(GetScriptForDestination(CScriptID(scripts[i])));
+        vScripts.push_back(GetScriptForWitness(scripts[i]));
+        vScripts.push_back(GetScriptForDestination(CScriptID(GetScriptForWitness(scripts[i]))));
+    }
+    vScripts.push_back(CScript() << OP_TRUE);
+    vScripts.push_back(CScript() << OP_RETURN << std::vector<unsigned char>(20, 1));
+    vScripts.push_back(CScript());
+
+    int nMine = CheckIsMine(wallet, vScripts);
+    BOOST_CHECK(nMine > 0);
+
+    // Redeem scripts make P2SH, P2WPKH and P2WSH outputs ours.
+    CScript p2pkh = GetScriptForDestination(keyCompressed.GetPubKey().GetID());
+    BOOST_REQUIRE(wallet.AddCScript(multisig));
+    BOOST_REQUIRE(wallet.AddCScript(GetScriptForWitness(p2pkh)));
+    BOOST_REQUIRE(wallet.AddCScript(GetScriptForWitness(multisig)));
+    BOOST_CHECK_EQUAL(CheckIsMine(wallet, vScripts), nMine + 5);
+    nMine += 5;
+
+    // Watch-only scripts of any shape, including ones no template matches.
+    BOOST_REQUIRE(wallet.AddWatchOnly(GetScriptForDestination(keyWatch.GetPubKey().GetID())));
+    BOOST_REQUIRE(wallet.AddWatchOnly(GetScriptForRawPubKey(keyOther.GetPubKey())));
+    BOOST_REQUIRE(wallet.AddWatchOnly(otherMultisig));
+    BOOST_REQUIRE(wallet.AddWatchOnly(CScript() << OP_TRUE));
+    BOOST_CHECK_EQUAL(CheckIsMine(wallet, vScripts), nMine + 4);
+}
+
+BOOST_AUTO_TEST_CASE(maybemine_after_filter_rebuilds)
+{
+    // Enough keys and scripts to fill the filter's smallest size several
+    // times, added one by one as a wallet does at run time and at load.
+    const int nKeys = 2500;
+    CWallet walletAdded, walletLoaded, walletCrypted;
+    LOCK(walletAdded.cs_wallet);
+    std::vector<CScript> vScripts;
+    for (int i = 0; i < nKeys; i++) {
+        CKey key = NewKey(i % 5 != 0);
+        CPubKey pubkey = key.GetPubKey();
+        CScript p2pkh = GetScriptForDestination(pubkey.GetID());
+        BOOST_REQUIRE(walletAdded.AddKeyPubKey(key, pubkey));
+        BOOST_REQUIRE(walletLoaded.LoadKey(key, pubkey));
+        BOOST_REQUIRE(walletCrypted.LoadCryptedKey(pubkey, std::vector<unsigned char>(48, i)));
+        vScripts.push_back(p2pkh);
+        vScripts.push_back(GetScriptForRawPubKey(pubkey));
+        if (i % 7 == 0 && key.IsCompressed()) {
+            CScript witness = GetScriptForWitness(p2pkh);
+            BOOST_REQUIRE(walletAdded.AddCScript(witness));
+            BOOST_REQUIRE(walletLoaded.LoadCScript(witness));
+            vScripts.push_back(witness);
+            vScripts.push_back(GetScriptForDestination(CScriptID(witness)));
+        }
+        if (i % 11 == 0) {
+            CScript watch = GetScriptForDestination(NewKey(true).GetPubKey().GetID());
+            BOOST_REQUIRE(walletAdded.AddWatchOnly(watch));
+            BOOST_REQUIRE(walletLoaded.LoadWatchOnly(watch));
+            vScripts.push_back(watch);
+        }
+    }
+
+    int nMine = CheckIsMine(walletAdded, vScripts);
+    BOOST_CHECK_EQUAL(nMine, (int)vScripts.size());
+    BOOST_CHECK_EQUAL(CheckIsMine(walletLoaded, vScripts), nMine);
+    BOOST_CHECK_EQUAL(CheckIsMine(walletCrypted, vScripts), 2 * nKeys);
+}
+
+BOOST_AUTO_TEST_CASE(hashfilter_no_false_negatives_across_reset)
+{
+    CHashFilter filter;
+    BOOST_CHECK(filter.IsFull());
+    BOOST_CHECK(!filter.contains(GetRandHash()));
+
+    std::vector<uint160> vKeyIDs;
+    std::vector<uint256> vHashes;
+    std::vector<COutPoint> vOutPoints;
+    std::vector<CScript> vScripts;
+    for (int i = 0; i < 3000; i++) {
+        uint256 hash = GetRandHash();
+        vKeyIDs.push_back(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)));
+        vHashes.push_back(hash);
+        vOutPoints.push_back(COutPoint(hash, i % 4));
+        vScripts.push_back(CScript() << std::vector<unsigned char>(hash.begin(), hash.end()) << OP_CHECKSIG);
+
+        // Grow the filter the way CWallet does once it is full: reset it
+        // to a larger size and insert every value again.
+        if (filter.IsFull()) {
+            filter.Reset(2 * 4 * vHashes.size());
+            for (size_t j = 0; j + 1 < vHashes.size(); j++) {
+                filter.insert(vKeyIDs[j]);
+                filter.insert(vHashes[j]);
+                filter.insert(vOutPoints[j]);
+                filter.insert(vScripts[j]);
+            }
+            BOOST_CHECK(!filter.IsFull());
+        }
+        filter.insert(vKeyIDs[i]);
+        filter.insert(vHashes[i]);
+        filter.insert(vOutPoints[i]);
+        filter.insert(vScripts[i]);
+    }
+    BOOST_CHECK_EQUAL(filter.size(), 4 * vHashes.size());
+
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        BOOST_CHECK(filter.contains(vKeyIDs[i]));
+        BOOST_CHECK(filter.contains(vHashes[i]));
+        BOOST_CHECK(filter.contains(vOutPoints[i]));
+        BOOST_CHECK(filter.contains(vScripts[i]));
+    }
+
+    // Few values that were never inserted match.
+    int nFalsePositives = 0;
+    for (int i = 0; i < 10000; i++)
+        nFalsePositives += filter.contains(GetRandHash());
+    BOOST_CHECK(nFalsePositives < 500);
+
+    // A reset empties the filter, and a smaller one still finds what is
+    // inserted again.
+    filter.Reset(8);
+    BOOST_CHECK_EQUAL(filter.size(), 0U);
+    for (int i = 0; i < 4; i++) {
+        filter.insert(vScripts[i]);
+        filter.insert(vOutPoints[i]);
+    }
+    BOOST_CHECK(filter.IsFull());
+    for (int i = 0; i < 4; i++) {
+        BOOST_CHECK(filter.contains(vScripts[i]));
+        BOOST_CHECK(filter.contains(vOutPoints[i]));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
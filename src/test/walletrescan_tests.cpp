@@ -0,0 +1,177 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "init.h"
+#include "keystore.h"
+#include "main.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "uint256.h"
+#include "wallet/wallet.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+extern std::atomic<bool> fRequestShutdown;
+
+namespace
+{
+
+/**
+ * Active chain of block index entries whose blocks are not on disk. A rescan
+ * over it finds nothing, but walks and reports the blocks as it would.
+ */
+struct CRescanChain
+{
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> vBlocks;
+
+    explicit CRescanChain(int nBlocks) : vHashes(nBlocks), vBlocks(nBlocks)
+    {
+        for (int i = 0; i < nBlocks; i++) {
+            vHashes[i] = ArithToUint256(arith_uint256(i + 1));
+            vBlocks[i].phashBlock = &vHashes[i];
+            vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+            vBlocks[i].nHeight = i;
+            vBlocks[i].nTime = 1400000000 + i * 90;
+            vBlocks[i].nChainTx = i + 1;
+            vBlocks[i].BuildSkip();
+        }
+        LOCK(cs_main);
+        chainActive.SetTip(&vBlocks.back());
+    }
+
+    ~CRescanChain()
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(NULL);
+    }
+};
+
+/** Spend output n of txFrom to the given outputs, signing with keystore */
+CMutableTransaction Spend(const CKeyStore& keystore, const CTransaction& txFrom, unsigned int n, const std::vector<CTxOut>& vout)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(txFrom.GetHash(), n)));
+    tx.vout = vout;
+    BOOST_REQUIRE(SignSignature(keystore, txFrom, tx, 0, SIGHASH_ALL));
+    return tx;
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(walletrescan_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(rescan_reaches_tip)
+{
+    CRescanChain chain(20);
+    CWallet wallet;
+
+    CBlockIndex* pindexScanned = NULL;
+    BOOST_CHECK_EQUAL(wallet.ScanForWalletTransactions(&chain.vBlocks[5], true, &pindexScanned), 0);
+    BOOST_CHECK(pindexScanned == &chain.vBlocks.back());
+    BOOST_CHECK(!wallet.IsScanning());
+}
+
+BOOST_AUTO_TEST_CASE(rescan_abort_reports_last_block_scanned)
+{
+    CRescanChain chain(20);
+    CWallet wallet;
+
+    // A shutdown request stops the scan before its first block: only the
+    // blocks before the start count as scanned.
+    StartShutdown();
+    CBlockIndex* pindexScanned = &chain.vBlocks.back();
+    wallet.ScanForWalletTransactions(&chain.vBlocks[5], true, &pindexScanned);
+    BOOST_CHECK(pindexScanned == &chain.vBlocks[4]);
+    BOOST_CHECK(!wallet.IsScanning());
+
+    // Nothing is scanned if the scan stops at the genesis block.
+    pindexScanned = &chain.vBlocks.back();
+    wallet.ScanForWalletTransactions(&chain.vBlocks[0], true, &pindexScanned);
+    BOOST_CHECK(pindexScanned == NULL);
+    BOOST_CHECK(!wallet.IsScanning());
+    fRequestShutdown = false;
+
+    // Without the request, the same scan covers every block up to the tip.
+    wallet.ScanForWalletTransactions(&chain.vBlocks[5], true, &pindexScanned);
+    BOOST_CHECK(pindexScanned == &chain.vBlocks.back());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(walletrescan_chain_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(rescan_adds_wallet_transactions_from_blocks)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    CScript scriptWallet = GetScriptForDestination(key.GetPubKey().GetID());
+    CScript scriptCoinbase = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    CBasicKeyStore keystore;
+    keystore.AddKey(coinbaseKey);
+    keystore.AddKey(key);
+
+    CWallet wallet;
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_REQUIRE(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    }
+
+    // A payment to the wallet key, next to a transaction that has nothing
+    // to do with the wallet.
+    std::vector<CMutableTransaction> vtx;
+    vtx.push_back(Spend(keystore, coinbaseTxns[0], 0, {CTxOut(10 * COIN, scriptWallet), CTxOut(5 * COIN, scriptWallet)}));
+    vtx.push_back(Spend(keystore, coinbaseTxns[1], 0, {CTxOut(COIN, scriptOther)}));
+    CTransaction txPayment = vtx[0], txUnrelated = vtx[1];
+    CreateAndProcessBlock(vtx, scriptCoinbase);
+
+    // The wallet already has an unconfirmed spend of the payment's second
+    // output, which a transaction in a later block conflicts with.
+    CTransaction txUnconfirmed = Spend(keystore, txPayment, 1, {CTxOut(4 * COIN, scriptWallet)});
+    BOOST_REQUIRE(wallet.AddToWallet(CWalletTx(&wallet, txUnconfirmed), false, NULL));
+
+    // A spend of the first output that pays none of the wallet's scripts,
+    // and the conflicting spend of the second.
+    vtx.clear();
+    vtx.push_back(Spend(keystore, txPayment, 0, {CTxOut(9 * COIN, scriptOther)}));
+    vtx.push_back(Spend(keystore, txPayment, 1, {CTxOut(4 * COIN, scriptOther)}));
+    CTransaction txSpend = vtx[0], txConflict = vtx[1];
+    CreateAndProcessBlock(vtx, scriptCoinbase);
+    BOOST_REQUIRE_EQUAL(chainActive.Height(), 102);
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(pcoinsTip->HaveCoin(COutPoint(txSpend.GetHash(), 0)));
+        BOOST_REQUIRE(pcoinsTip->HaveCoin(COutPoint(txConflict.GetHash(), 0)));
+    }
+
+    CBlockIndex* pindexScanned = NULL;
+    BOOST_CHECK_EQUAL(wallet.ScanForWalletTransactions(chainActive.Genesis(), true, &pindexScanned), 3);
+    BOOST_CHECK(pindexScanned == chainActive.Tip());
+
+    LOCK2(cs_main, wallet.cs_wallet);
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 4U);
+    BOOST_CHECK(wallet.mapWallet.count(txPayment.GetHash()));
+    BOOST_CHECK(wallet.mapWallet.count(txSpend.GetHash()));
+    BOOST_CHECK(wallet.mapWallet.count(txConflict.GetHash()));
+    BOOST_CHECK(!wallet.mapWallet.count(txUnrelated.GetHash()));
+    BOOST_CHECK_EQUAL(wallet.mapWallet[txPayment.GetHash()].GetDepthInMainChain(), 2);
+    BOOST_CHECK_EQUAL(wallet.mapWallet[txSpend.GetHash()].GetDepthInMainChain(), 1);
+    BOOST_CHECK_EQUAL(wallet.mapWallet[txConflict.GetHash()].GetDepthInMainChain(), 1);
+    BOOST_CHECK_EQUAL(wallet.mapWallet[txUnconfirmed.GetHash()].GetDepthInMainChain(), -1);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+
+    // A second scan finds the same transactions and adds nothing new.
+    BOOST_CHECK_EQUAL(wallet.ScanForWalletTransactions(chainActive.Genesis(), false), 0);
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 4U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
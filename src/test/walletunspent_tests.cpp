@@ -0,0 +1,242 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "amount.h"
+#include "chain.h"
+#include "consensus/merkle.h"
+#include "key.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "wallet/wallet.h"
+
+#include <set>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+
+/**
+ * Blocks that are indexed but never validated, so that wallet transactions
+ * in them get a depth. The test moves the active tip between branches.
+ */
+struct CWalletTestChain
+{
+    std::vector<CBlockIndex*> vIndex;
+
+    CBlockIndex* AddBlock(CBlockIndex* pprev, const std::vector<CTransaction>& vtx, CBlock& block)
+    {
+        block.SetNull();
+        block.nVersion = 4;
+        if (pprev)
+            block.hashPrevBlock = pprev->GetBlockHash();
+        block.nTime = 1400000000 + vIndex.size() * 90;
+        block.vtx = vtx;
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+
+        LOCK(cs_main);
+        CBlockIndex* pindex = new CBlockIndex(block);
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(block.GetHash(), pindex)).first;
+        pindex->phashBlock = &mi->first;
+        pindex->pprev = pprev;
+        pindex->nHeight = pprev ? pprev->nHeight + 1 : 0;
+        pindex->BuildSkip();
+        vIndex.push_back(pindex);
+        return pindex;
+    }
+
+    void SetTip(CBlockIndex* pindex)
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(pindex);
+    }
+
+    ~CWalletTestChain()
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(NULL);
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            mapBlockIndex.erase(vIndex[i]->GetBlockHash());
+            delete vIndex[i];
+        }
+    }
+};
+
+CTransaction MakeTx(const std::vector<COutPoint>& vPrevouts, const std::vector<std::pair<CScript, CAmount> >& vOutputs)
+{
+    CMutableTransaction tx;
+    for (size_t i = 0; i < vPrevouts.size(); i++)
+        tx.vin.push_back(CTxIn(vPrevouts[i]));
+    for (size_t i = 0; i < vOutputs.size(); i++)
+        tx.vout.push_back(CTxOut(vOutputs[i].second, vOutputs[i].first));
+    return tx;
+}
+
+/**
+ * Check AvailableCoins and the balances, which only look at the outputs in
+ * the unspent index, against a scan of every output in mapWallet.
+ */
+void CheckUnspentMatchesScan(const CWallet& wallet)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    std::set<COutPoint> setExpected;
+    CAmount nBalance = 0, nUnconfirmed = 0, nImmature = 0;
+    CAmount nWatchOnly = 0, nUnconfirmedWatchOnly = 0, nImmatureWatchOnly = 0;
+    for (std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it) {
+        const CWalletTx& wtx = it->second;
+        int nDepth = wtx.GetDepthInMainChain();
+        if (wtx.IsTrusted()) {
+            nBalance += wtx.GetAvailableCredit(false);
+            nWatchOnly += wtx.GetAvailableWatchOnlyCredit(false);
+        } else if (nDepth == 0 && wtx.InMempool()) {
+            nUnconfirmed += wtx.GetAvailableCredit(false);
+            nUnconfirmedWatchOnly += wtx.GetAvailableWatchOnlyCredit(false);
+        }
+        nImmature += wtx.GetImmatureCredit(false);
+        nImmatureWatchOnly += wtx.GetImmatureWatchOnlyCredit(false);
+
+        if (!CheckFinalTx(wtx) || nDepth < 0 || (nDepth == 0 && !wtx.InMempool()))
+            continue;
+        if (wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0)
+            continue;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++)
+            if (wallet.IsMine(wtx.vout[i]) != ISMINE_NO && !wallet.IsSpent(it->first, i))
+                setExpected.insert(COutPoint(it->first, i));
+    }
+
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins, false, NULL, true);
+    std::set<COutPoint> setAvailable;
+    for (size_t i = 0; i < vCoins.size(); i++)
+        setAvailable.insert(COutPoint(vCoins[i].tx->GetHash(), vCoins[i].i));
+    BOOST_CHECK(setAvailable == setExpected);
+
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), nUnconfirmed);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), nImmature);
+    BOOST_CHECK_EQUAL(wallet.GetWatchOnlyBalance(), nWatchOnly);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedWatchOnlyBalance(), nUnconfirmedWatchOnly);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureWatchOnlyBalance(), nImmatureWatchOnly);
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(walletunspent_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(unspent_index_matches_full_scan)
+{
+    CWalletTestChain chain;
+    CWallet wallet;
+
+    CKey key1, key2, key3, keyOther;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    key3.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    CScript script1 = GetScriptForDestination(key1.GetPubKey().GetID());
+    CScript script2 = GetScriptForDestination(key2.GetPubKey().GetID());
+    CScript script3 = GetScriptForDestination(key3.GetPubKey().GetID());
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    CScript scriptWatch = GetScriptForRawPubKey(keyOther.GetPubKey());
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_REQUIRE(wallet.AddKeyPubKey(key1, key1.GetPubKey()));
+        BOOST_REQUIRE(wallet.AddKeyPubKey(key2, key2.GetPubKey()));
+    }
+
+    // A pays both wallet keys.
+    CTransaction txA = MakeTx({COutPoint(GetRandHash(), 0)}, {{script1, 5 * COIN}, {script2, 3 * COIN}});
+    CBlock block1;
+    CBlockIndex* pindex1 = chain.AddBlock(NULL, {txA}, block1);
+    chain.SetTip(pindex1);
+    wallet.SyncTransaction(txA, pindex1, &block1);
+    CheckUnspentMatchesScan(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 8 * COIN);
+
+    // B spends A:0 but never confirms; abandoning it frees A:0 again.
+    CTransaction txB = MakeTx({COutPoint(txA.GetHash(), 0)}, {{scriptOther, 5 * COIN}});
+    wallet.SyncTransaction(txB, NULL, NULL);
+    CheckUnspentMatchesScan(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 3 * COIN);
+    BOOST_CHECK(wallet.AbandonTransaction(txB.GetHash()));
+    CheckUnspentMatchesScan(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 8 * COIN);
+
+    // C spends A:1 in block 2a.
+    CTransaction txC = MakeTx({COutPoint(txA.GetHash(), 1)}, {{script1, 2 * COIN}});
+    CBlock block2a;
+    CBlockIndex* pindex2a = chain.AddBlock(pindex1, {txC}, block2a);
+    chain.SetTip(pindex2a);
+    wallet.SyncTransaction(txC, pindex2a, &block2a);
+    CheckUnspentMatchesScan(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 7 * COIN);
+
+    // Block 2a is reorged out for 2b, where D spends A:1 instead: C is
+    // marked conflicted.
+    chain.SetTip(pindex1);
+    wallet.SyncTransaction(txC, pindex1, NULL);
+    CheckUnspentMatchesScan(wallet);
+    CTransaction txD = MakeTx({COutPoint(txA.GetHash(), 1)}, {{scriptOther, 3 * COIN}});
+    CBlock block2b;
+    CBlockIndex* pindex2b = chain.AddBlock(pindex1, {txD}, block2b);
+    chain.SetTip(pindex2b);
+    wallet.SyncTransaction(txD, pindex2b, &block2b);
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        BOOST_CHECK(wallet.mapWallet[txC.GetHash()].GetDepthInMainChain() < 0);
+    }
+    CheckUnspentMatchesScan(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 5 * COIN);
+
+    // E spends A:0 to a key and a script the wallet does not know yet.
+    CTransaction txE = MakeTx({COutPoint(txA.GetHash(), 0)}, {{script3, 3 * COIN}, {scriptWatch, 1 * COIN}, {script1, COIN / 2}});
+    CBlock block3b;
+    CBlockIndex* pindex3b = chain.AddBlock(pindex2b, {txE}, block3b);
+    chain.SetTip(pindex3b);
+    wallet.SyncTransaction(txE, pindex3b, &block3b);
+    CheckUnspentMatchesScan(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), COIN / 2);
+
+    // Import the key and the watch-only script the way importprivkey and
+    // importaddress do.
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        wallet.MarkDirty();
+        BOOST_REQUIRE(wallet.AddKeyPubKey(key3, key3.GetPubKey()));
+        wallet.MarkUnspentDirty();
+        wallet.MarkDirty();
+        BOOST_REQUIRE(wallet.AddWatchOnly(scriptWatch));
+        wallet.MarkUnspentDirty();
+    }
+    CheckUnspentMatchesScan(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 3 * COIN + COIN / 2);
+    BOOST_CHECK_EQUAL(wallet.GetWatchOnlyBalance(), 1 * COIN);
+
+    // Reorg back to the 2a branch: C confirms again, D is conflicted and E
+    // drops out of the chain while still spending A:0.
+    chain.SetTip(pindex2b);
+    wallet.SyncTransaction(txE, pindex2b, NULL);
+    chain.SetTip(pindex1);
+    wallet.SyncTransaction(txD, pindex1, NULL);
+    chain.SetTip(pindex2a);
+    wallet.SyncTransaction(txC, pindex2a, &block2a);
+    CBlock block3a;
+    chain.SetTip(chain.AddBlock(pindex2a, std::vector<CTransaction>(), block3a));
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        BOOST_CHECK(wallet.mapWallet[txC.GetHash()].GetDepthInMainChain() == 2);
+        BOOST_CHECK(wallet.mapWallet[txD.GetHash()].GetDepthInMainChain() < 0);
+        BOOST_CHECK(wallet.mapWallet[txE.GetHash()].GetDepthInMainChain() == 0);
+    }
+    CheckUnspentMatchesScan(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 2 * COIN);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
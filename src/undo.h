@@ -12,32 +12,36 @@
 
 /** Undo information for a CTxIn
  *
- *  Contains the prevout's CTxOut being spent, and if this was the
- *  last output of the affected transaction, its metadata as well
- *  (coinbase or not, height, transaction version)
+ *  Contains the prevout's CTxOut being spent, and its metadata (coinbase or
+ *  not, height). Undo data written by older versions only carries the
+ *  metadata for the last spent output of a transaction, and has a height of
+ *  0 for the others.
  */
 class CTxInUndo
 {
 public:
     CTxOut txout;         // the txout data before being spent
-    bool fCoinBase;       // if the outpoint was the last unspent: whether it belonged to a coinbase
-    unsigned int nHeight; // if the outpoint was the last unspent: its height
-    int nVersion;         // if the outpoint was the last unspent: its version
+    bool fCoinBase;       // whether the outpoint belonged to a coinbase
+    unsigned int nHeight; // the outpoint's height, or 0 if unknown (see above)
 
-    CTxInUndo() : txout(), fCoinBase(false), nHeight(0), nVersion(0) {}
-    CTxInUndo(const CTxOut &txoutIn, bool fCoinBaseIn = false, unsigned int nHeightIn = 0, int nVersionIn = 0) : txout(txoutIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), nVersion(nVersionIn) { }
+    CTxInUndo() : txout(), fCoinBase(false), nHeight(0) {}
+    CTxInUndo(const CTxOut &txoutIn, bool fCoinBaseIn = false, unsigned int nHeightIn = 0) : txout(txoutIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn) { }
 
     unsigned int GetSerializeSize(int nType, int nVersion) const {
+        int nTxVersion = 0;
         return ::GetSerializeSize(VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion) +
-               (nHeight > 0 ? ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion) : 0) +
+               (nHeight > 0 ? ::GetSerializeSize(VARINT(nTxVersion), nType, nVersion) : 0) +
                ::GetSerializeSize(CTxOutCompressor(REF(txout)), nType, nVersion);
     }
 
     template<typename Stream>
     void Serialize(Stream &s, int nType, int nVersion) const {
         ::Serialize(s, VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion);
-        if (nHeight > 0)
-            ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
+        if (nHeight > 0) {
+            // Older versions stored the transaction version here
+            int nTxVersion = 0;
+            ::Serialize(s, VARINT(nTxVersion), nType, nVersion);
+        }
         ::Serialize(s, CTxOutCompressor(REF(txout)), nType, nVersion);
     }
 
@@ -47,8 +51,10 @@ public:
         ::Unserialize(s, VARINT(nCode), nType, nVersion);
         nHeight = nCode / 2;
         fCoinBase = nCode & 1;
-        if (nHeight > 0)
-            ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
+        if (nHeight > 0) {
+            int nTxVersion = 0;
+            ::Unserialize(s, VARINT(nTxVersion), nType, nVersion);
+        }
         ::Unserialize(s, REF(CTxOutCompressor(REF(txout))), nType, nVersion);
     }
 };
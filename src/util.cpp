@@ -737,6 +737,14 @@ void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length) {
 #endif
 }
 
+void AdviseSequentialRead(FILE *file) {
+#if defined(__linux__)
+    // Advisory only, so failure is not an error
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_WILLNEED);
+#endif
+}
+
 void ShrinkDebugFile()
 {
     // Scroll debug.log if it's getting too big
@@ -0,0 +1,81 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/coinselection.h"
+
+#include <limits>
+
+bool SelectCoinsBnB(const std::vector<CAmount>& vValues, const CAmount& nTarget, const CAmount& nCostOfChange,
+                    std::vector<size_t>& vSelectedRet, CAmount& nValueRet, size_t nMaxTries)
+{
+    vSelectedRet.clear();
+    nValueRet = 0;
+
+    // Sum of the values no decision was made about yet
+    CAmount nRemaining = 0;
+    for (size_t i = 0; i < vValues.size(); i++)
+        nRemaining += vValues[i];
+    if (nRemaining < nTarget)
+        return false;
+
+    // vfIncluded[i] is the decision about vValues[i] on the current branch
+    std::vector<char> vfIncluded;
+    vfIncluded.reserve(vValues.size());
+    std::vector<char> vfBest;
+    bool fFound = false;
+    CAmount nCurrent = 0;
+    CAmount nBest = std::numeric_limits<CAmount>::max();
+
+    for (size_t nTries = 0; nTries < nMaxTries; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nCurrent + nRemaining < nTarget || nCurrent > nTarget + nCostOfChange) {
+            fBacktrack = true;
+        } else if (nCurrent >= nTarget) {
+            if (nCurrent < nBest) {
+                nBest = nCurrent;
+                vfBest = vfIncluded;
+                fFound = true;
+                if (nBest == nTarget)
+                    break;
+            }
+            // Adding more would only move further from the target.
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            // Return to the last value included and leave it out instead.
+            while (!vfIncluded.empty() && !vfIncluded.back()) {
+                nRemaining += vValues[vfIncluded.size() - 1];
+                vfIncluded.pop_back();
+            }
+            if (vfIncluded.empty())
+                break;
+            vfIncluded.back() = false;
+            nCurrent -= vValues[vfIncluded.size() - 1];
+        } else {
+            // Not backtracking means nRemaining > 0, so values are left.
+            size_t i = vfIncluded.size();
+            nRemaining -= vValues[i];
+            // Including a value equal to the one just left out would search
+            // the same subsets again.
+            if (i > 0 && !vfIncluded[i - 1] && vValues[i] == vValues[i - 1]) {
+                vfIncluded.push_back(false);
+            } else {
+                vfIncluded.push_back(true);
+                nCurrent += vValues[i];
+            }
+        }
+    }
+
+    if (!fFound)
+        return false;
+    for (size_t i = 0; i < vfBest.size(); i++) {
+        if (vfBest[i]) {
+            vSelectedRet.push_back(i);
+            nValueRet += vValues[i];
+        }
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_COINSELECTION_H
+#define BITCOIN_WALLET_COINSELECTION_H
+
+#include "amount.h"
+
+#include <stddef.h>
+#include <vector>
+
+//! Nodes the branch and bound search may visit before giving up
+static const size_t BNB_MAX_TRIES = 100000;
+
+/**
+ * What selecting coins by effective value needs to know about the
+ * transaction. The effective value of a coin is its value minus the fee to
+ * spend it at feeRate.
+ */
+struct CCoinSelectionParams
+{
+    //! Fee rate the transaction is expected to pay
+    CFeeRate feeRate;
+    //! Fee for the transaction without its inputs
+    CAmount nFeeNoInputs;
+    //! Fee for a change output plus the fee to spend it later
+    CAmount nCostOfChange;
+
+    CCoinSelectionParams() : nFeeNoInputs(0), nCostOfChange(0) {}
+};
+
+/**
+ * Search for a subset of vValues adding up to between nTarget and
+ * nTarget + nCostOfChange, so that the rest can go to fees instead of a
+ * change output. vValues must be positive and sorted in descending order.
+ *
+ * The search is depth first: every value is either included or left out,
+ * and a branch is given up as soon as it overshoots the window or the values
+ * left can no longer reach nTarget. Of the subsets found, the one closest
+ * to nTarget wins. At most nMaxTries nodes are visited.
+ *
+ * On success, vSelectedRet holds the positions of the chosen values in
+ * vValues and nValueRet their sum.
+ */
+bool SelectCoinsBnB(const std::vector<CAmount>& vValues, const CAmount& nTarget, const CAmount& nCostOfChange,
+                    std::vector<size_t>& vSelectedRet, CAmount& nValueRet, size_t nMaxTries = BNB_MAX_TRIES);
+
+#endif // BITCOIN_WALLET_COINSELECTION_H
@@ -140,6 +140,7 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
 
         if (!pwalletMain->AddKeyPubKey(key, pubkey))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
+        pwalletMain->MarkUnspentDirty();
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
@@ -173,6 +174,7 @@ void ImportScript(const CScript& script, const string& strLabel, bool isRedeemSc
             pwalletMain->SetAddressBook(destination, strLabel, "receive");
         }
     }
+    pwalletMain->MarkUnspentDirty();
 }
 
 void ImportAddress(const CBitcoinAddress& address, const string& strLabel)
@@ -252,6 +254,34 @@ UniValue importaddress(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+UniValue abortrescan(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "abortrescan\n"
+            "\nStops the current wallet rescan triggered e.g. by an importprivkey call.\n"
+            "The transactions found up to the last block scanned stay in the wallet.\n"
+            "\nResult:\n"
+            "true|false       (boolean) Whether a rescan was running and is being stopped\n"
+            "\nExamples:\n"
+            "\nImport a private key\n"
+            + HelpExampleCli("importprivkey", "\"mykey\"") +
+            "\nAbort the running wallet rescan\n"
+            + HelpExampleCli("abortrescan", "") +
+            "\nAs a JSON-RPC call\n"
+            + HelpExampleRpc("abortrescan", "")
+        );
+
+    // No locks: the rescan holds cs_main and cs_wallet until it stops.
+    if (!pwalletMain->IsScanning() || pwalletMain->IsAbortingRescan())
+        return false;
+    pwalletMain->AbortRescan();
+    return true;
+}
+
 UniValue importprunedfunds(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -495,6 +525,7 @@ UniValue importwallet(const UniValue& params, bool fHelp)
         nTimeBegin = std::min(nTimeBegin, nTime);
     }
     file.close();
+    pwalletMain->MarkUnspentDirty();
     pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
 
     CBlockIndex *pindex = chainActive.Tip();
@@ -960,6 +960,105 @@ UniValue sendmany(const UniValue& params, bool fHelp)
     return wtx.GetHash().GetHex();
 }
 
+UniValue sendbatch(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "sendbatch {\"address\":amount,...} ( \"comment\" )\n"
+            "\nPay many addresses at once, in as few transactions as the standard transaction size allows.\n"
+            "Coins are selected once for the whole batch among confirmed outputs, inputs are signed on several\n"
+            "threads and all transactions are written to the wallet together. The sender pays the fee.\n"
+            "Amounts are double-precision floating point numbers."
+            + HelpRequiringPassphrase() + "\n"
+            "\nArguments:\n"
+            "1. \"amounts\"             (string, required) A json object with addresses and amounts\n"
+            "    {\n"
+            "      \"address\":amount   (numeric or string) The mooncoin address is the key, the numeric amount (can be string) in " + CURRENCY_UNIT + " is the value\n"
+            "      ,...\n"
+            "    }\n"
+            "2. \"comment\"             (string, optional) A comment stored with every transaction\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txids\": [              (array of string) The ids of the transactions, in the order of the recipients they pay\n"
+            "    \"transactionid\"\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"fee\": x.xxx            (numeric) The fee paid by all transactions together in " + CURRENCY_UNIT + "\n"
+            "}\n"
+            "\nExamples:\n"
+            "\nPay two addresses:\n"
+            + HelpExampleCli("sendbatch", "\"{\\\"LEr4hNAefWYhBMgxCFP2Po1NPrUeiK8kM2\\\":0.01,\\\"LbhhnrHHVFP1eUjP1tdNIYeEVsNHfN9FCw\\\":0.02}\"") +
+            "\nPay two addresses with a comment:\n"
+            + HelpExampleCli("sendbatch", "\"{\\\"LEr4hNAefWYhBMgxCFP2Po1NPrUeiK8kM2\\\":0.01,\\\"LbhhnrHHVFP1eUjP1tdNIYeEVsNHfN9FCw\\\":0.02}\" \"payout 42\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendbatch", "\"{\\\"LEr4hNAefWYhBMgxCFP2Po1NPrUeiK8kM2\\\":0.01,\\\"LbhhnrHHVFP1eUjP1tdNIYeEVsNHfN9FCw\\\":0.02}\", \"payout 42\"")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    UniValue sendTo = params[0].get_obj();
+    string strComment;
+    if (params.size() > 1 && !params[1].isNull())
+        strComment = params[1].get_str();
+
+    set<CBitcoinAddress> setAddress;
+    vector<CRecipient> vecSend;
+
+    CAmount totalAmount = 0;
+    vector<string> keys = sendTo.getKeys();
+    BOOST_FOREACH(const string& name_, keys)
+    {
+        CBitcoinAddress address(name_);
+        if (!address.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("Invalid Mooncoin address: ")+name_);
+
+        if (setAddress.count(address))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, duplicated address: ")+name_);
+        setAddress.insert(address);
+
+        CScript scriptPubKey = GetScriptForDestination(address.Get());
+        CAmount nAmount = AmountFromValue(sendTo[name_]);
+        if (nAmount <= 0)
+            throw JSONRPCError(RPC_TYPE_ERROR, "Invalid amount for send");
+        totalAmount += nAmount;
+
+        CRecipient recipient = {scriptPubKey, nAmount, false};
+        vecSend.push_back(recipient);
+    }
+
+    EnsureWalletIsUnlocked();
+
+    // Check funds
+    if (totalAmount > pwalletMain->GetBalance())
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Insufficient funds");
+
+    // Send
+    vector<CWalletTx> vwtx;
+    vector<boost::shared_ptr<CReserveKey> > vKeyChange;
+    CAmount nFeeRequired = 0;
+    string strFailReason;
+    if (!pwalletMain->CreatePayoutTransactions(vecSend, vwtx, vKeyChange, nFeeRequired, strFailReason))
+        throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, strFailReason);
+    BOOST_FOREACH(CWalletTx& wtx, vwtx)
+    {
+        if (!strComment.empty())
+            wtx.mapValue["comment"] = strComment;
+    }
+    if (!pwalletMain->CommitTransactions(vwtx, vKeyChange))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Transaction commit failed");
+
+    UniValue txids(UniValue::VARR);
+    BOOST_FOREACH(const CWalletTx& wtx, vwtx)
+        txids.push_back(wtx.GetHash().GetHex());
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txids", txids));
+    result.push_back(Pair("fee", ValueFromAmount(nFeeRequired)));
+    return result;
+}
+
 // Defined in rpc/misc.cpp
 extern CScript _createmultisig_redeemScript(const UniValue& params);
 
@@ -1006,6 +1105,7 @@ UniValue addmultisigaddress(const UniValue& params, bool fHelp)
     CScript inner = _createmultisig_redeemScript(params);
     CScriptID innerID(inner);
     pwalletMain->AddCScript(inner);
+    pwalletMain->MarkUnspentDirty();
 
     pwalletMain->SetAddressBook(innerID, strAccount, "send");
     return CBitcoinAddress(innerID).ToString();
@@ -1094,6 +1194,7 @@ UniValue addwitnessaddress(const UniValue& params, bool fHelp)
     if (!ret) {
         throw JSONRPCError(RPC_WALLET_ERROR, "Public key or redeemscript not known to wallet, or the key is uncompressed");
     }
+    pwalletMain->MarkUnspentDirty();
 
     pwalletMain->SetAddressBook(w.result, "", "receive");
 
@@ -2449,7 +2550,8 @@ UniValue fundrawtransaction(const UniValue& params, bool fHelp)
         throw runtime_error(
                             "fundrawtransaction \"hexstring\" ( options )\n"
                             "\nAdd inputs to a transaction until it has enough in value to meet its out value.\n"
-                            "This will not modify existing inputs, and will add one change output to the outputs.\n"
+                            "This will not modify existing inputs, and will add at most one change output to the outputs.\n"
+                            "No change output is added when inputs are found that leave too little over the fee to be worth one.\n"
                             "Note that inputs which were signed may need to be resigned after completion since in/outputs have been added.\n"
                             "The inputs added will not be signed, use signrawtransaction for that.\n"
                             "Note that all existing inputs must have their previous output transaction be in the wallet.\n"
@@ -2575,6 +2677,7 @@ extern UniValue dumpwallet(const UniValue& params, bool fHelp);
 extern UniValue importwallet(const UniValue& params, bool fHelp);
 extern UniValue importprunedfunds(const UniValue& params, bool fHelp);
 extern UniValue removeprunedfunds(const UniValue& params, bool fHelp);
+extern UniValue abortrescan(const UniValue& params, bool fHelp);
 
 static const CRPCCommand commands[] =
 { //  category              name                        actor (function)           okSafeMode
@@ -2582,6 +2685,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "fundrawtransaction",       &fundrawtransaction,       false },
     { "hidden",             "resendwallettransactions", &resendwallettransactions, true  },
     { "wallet",             "abandontransaction",       &abandontransaction,       false },
+    { "wallet",             "abortrescan",              &abortrescan,              true  },
     { "wallet",             "addmultisigaddress",       &addmultisigaddress,       true  },
     { "wallet",             "addwitnessaddress",        &addwitnessaddress,        true  },
     { "wallet",             "backupwallet",             &backupwallet,             true  },
@@ -2617,6 +2721,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "move",                     &movecmd,                  false },
     { "wallet",             "sendfrom",                 &sendfrom,                 false },
     { "wallet",             "sendmany",                 &sendmany,                 false },
+    { "wallet",             "sendbatch",                &sendbatch,                false },
     { "wallet",             "sendtoaddress",            &sendtoaddress,            false },
     { "wallet",             "setaccount",               &setaccount,               true  },
     { "wallet",             "settxfee",                 &settxfee,                 true  },
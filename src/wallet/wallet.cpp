@@ -11,6 +11,7 @@
 #include "coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "init.h"
 #include "key.h"
 #include "keystore.h"
 #include "main.h"
@@ -30,6 +31,7 @@
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -161,6 +163,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    AddToScriptFilter(pubkey.GetID());
 
     // check if we need to remove from watch-only
     CScript script;
@@ -186,6 +189,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    AddToScriptFilter(vchPubKey.GetID());
     if (!fFileBacked)
         return true;
     {
@@ -212,15 +216,27 @@ bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
     return true;
 }
 
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    AddToScriptFilter(pubkey.GetID());
+    return true;
+}
+
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    AddToScriptFilter(vchPubKey.GetID());
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    AddToScriptFilter(CScriptID(redeemScript));
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -239,13 +255,17 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
-    return CCryptoKeyStore::AddCScript(redeemScript);
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    AddToScriptFilter(CScriptID(redeemScript));
+    return true;
 }
 
 bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    AddToScriptFilter(dest);
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -258,6 +278,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    MarkUnspentDirty();
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -269,7 +290,46 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
 
 bool CWallet::LoadWatchOnly(const CScript &dest)
 {
-    return CCryptoKeyStore::AddWatchOnly(dest);
+    if (!CCryptoKeyStore::AddWatchOnly(dest))
+        return false;
+    AddToScriptFilter(dest);
+    return true;
+}
+
+void CWallet::AddToScriptFilter(const uint160& hash)
+{
+    LOCK(cs_KeyStore);
+    if (filterScripts.contains(hash))
+        return;
+    if (filterScripts.IsFull())
+        RebuildScriptFilter(); // picks up hash, which is in the keystore already
+    else
+        filterScripts.insert(hash);
+}
+
+void CWallet::AddToScriptFilter(const CScript& watchOnly)
+{
+    LOCK(cs_KeyStore);
+    if (filterScripts.contains(watchOnly))
+        return;
+    if (filterScripts.IsFull())
+        RebuildScriptFilter();
+    else
+        filterScripts.insert(watchOnly);
+}
+
+void CWallet::RebuildScriptFilter()
+{
+    AssertLockHeld(cs_KeyStore);
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    filterScripts.Reset(std::max<size_t>(1024, 2 * (setKeys.size() + mapScripts.size() + setWatchOnly.size())));
+    BOOST_FOREACH(const CKeyID& keyID, setKeys)
+        filterScripts.insert(keyID);
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+        filterScripts.insert(it->first);
+    BOOST_FOREACH(const CScript& script, setWatchOnly)
+        filterScripts.insert(script);
 }
 
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
@@ -530,6 +590,7 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
+    AddToCoinFilter(outpoint);
 
     pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -548,6 +609,131 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::AddToCoinFilter(const uint256& txid)
+{
+    if (filterCoins.contains(txid))
+        return;
+    if (filterCoins.IsFull())
+        RebuildCoinFilter(); // picks up txid, which is in mapWallet already
+    else
+        filterCoins.insert(txid);
+}
+
+void CWallet::AddToCoinFilter(const COutPoint& outpoint)
+{
+    if (filterCoins.contains(outpoint))
+        return;
+    if (filterCoins.IsFull())
+        RebuildCoinFilter();
+    else
+        filterCoins.insert(outpoint);
+}
+
+void CWallet::RebuildCoinFilter()
+{
+    filterCoins.Reset(std::max<size_t>(1024, 2 * (mapWallet.size() + mapTxSpends.size())));
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        filterCoins.insert(it->first);
+    for (TxSpends::const_iterator it = mapTxSpends.begin(); it != mapTxSpends.end(); ++it)
+        filterCoins.insert(it->first);
+}
+
+/** Whether wtx spends its inputs in any chain, as far as IsSpent is concerned */
+static bool IsActiveSpend(const CWalletTx& wtx)
+{
+    return !wtx.isAbandoned() && (wtx.hashUnset() || wtx.nIndex != -1);
+}
+
+void CWallet::UpdateUnspent(const COutPoint& outpoint) const
+{
+    AssertLockHeld(cs_wallet);
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+    bool fUnspent = mi != mapWallet.end() && outpoint.n < mi->second.vout.size() && IsMine(mi->second.vout[outpoint.n]) != ISMINE_NO;
+    if (fUnspent) {
+        std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+        for (TxSpends::const_iterator it = range.first; it != range.second && fUnspent; ++it) {
+            std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+            if (mit != mapWallet.end() && IsActiveSpend(mit->second))
+                fUnspent = false;
+        }
+    }
+    if (fUnspent)
+        setUnspent.insert(outpoint);
+    else
+        setUnspent.erase(outpoint);
+}
+
+void CWallet::UpdateUnspent(const CWalletTx& wtx) const
+{
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        UpdateUnspent(COutPoint(hash, i));
+    if (!wtx.IsCoinBase()) {
+        BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+            UpdateUnspent(txin.prevout);
+    }
+}
+
+void CWallet::RebuildUnspent() const
+{
+    AssertLockHeld(cs_wallet);
+    setUnspent.clear();
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        for (unsigned int i = 0; i < it->second.vout.size(); i++)
+            UpdateUnspent(COutPoint(it->first, i));
+    }
+    fUnspentDirty = false;
+}
+
+void CWallet::MarkUnspentDirty()
+{
+    LOCK(cs_wallet);
+    fUnspentDirty = true;
+}
+
+const std::set<COutPoint>& CWallet::GetUnspent() const
+{
+    AssertLockHeld(cs_wallet);
+    if (fUnspentDirty)
+        RebuildUnspent();
+    return setUnspent;
+}
+
+std::vector<const CWalletTx*> CWallet::GetUnspentTxs() const
+{
+    AssertLockHeld(cs_wallet);
+    const std::set<COutPoint>& setOutputs = GetUnspent();
+    std::vector<const CWalletTx*> vTxs;
+    for (std::set<COutPoint>::const_iterator it = setOutputs.begin(); it != setOutputs.end(); ++it) {
+        if (!vTxs.empty() && vTxs.back()->GetHash() == it->hash)
+            continue;
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->hash);
+        if (mi != mapWallet.end())
+            vTxs.push_back(&mi->second);
+    }
+    return vTxs;
+}
+
+bool CWallet::MayInvolveWallet(const CTransaction& tx, bool fCheckOutputs) const
+{
+    AssertLockHeld(cs_wallet);
+    if (filterCoins.contains(tx.GetHash()))
+        return true;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        if (filterCoins.contains(txin.prevout.hash) || filterCoins.contains(txin.prevout))
+            return true;
+    }
+    if (!fCheckOutputs)
+        return false;
+    LOCK(cs_KeyStore);
+    bool fWatchOnly = !setWatchOnly.empty();
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        if (MayBeMine(filterScripts, txout.scriptPubKey, fWatchOnly))
+            return true;
+    }
+    return false;
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -738,6 +924,8 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        // Transactions may have been removed.
+        fUnspentDirty = true;
     }
 }
 
@@ -748,6 +936,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
     if (fFromLoadWallet)
     {
         mapWallet[hash] = wtxIn;
+        AddToCoinFilter(hash);
         CWalletTx& wtx = mapWallet[hash];
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
@@ -771,6 +960,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         bool fInsertedNew = ret.second;
         if (fInsertedNew)
         {
+            AddToCoinFilter(hash);
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext(pwalletdb);
             wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
@@ -853,12 +1043,13 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
         // Write to disk
-        if (fInsertedNew || fUpdated)
+        if (fFileBacked && (fInsertedNew || fUpdated))
             if (!pwalletdb->WriteTx(wtx))
                 return false;
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        UpdateUnspent(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -886,6 +1077,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
     {
         AssertLockHeld(cs_wallet);
 
+        if (!MayInvolveWallet(tx))
+            return false;
+
         if (pblock) {
             BOOST_FOREACH(const CTxIn& txin, tx.vin) {
                 std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(txin.prevout);
@@ -954,6 +1148,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.setAbandoned();
             wtx.MarkDirty();
+            UpdateUnspent(wtx);
             walletdb.WriteTx(wtx);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
@@ -1016,6 +1211,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
+            UpdateUnspent(wtx);
             walletdb.WriteTx(wtx);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
@@ -1058,6 +1254,8 @@ isminetype CWallet::IsMine(const CTxIn &txin) const
 {
     {
         LOCK(cs_wallet);
+        if (!filterCoins.contains(txin.prevout.hash))
+            return ISMINE_NO;
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
         if (mi != mapWallet.end())
         {
@@ -1073,6 +1271,8 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 {
     {
         LOCK(cs_wallet);
+        if (!filterCoins.contains(txin.prevout.hash))
+            return 0;
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
         if (mi != mapWallet.end())
         {
@@ -1087,6 +1287,11 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 
 isminetype CWallet::IsMine(const CTxOut& txout) const
 {
+    {
+        LOCK(cs_KeyStore);
+        if (!MayBeMine(filterScripts, txout.scriptPubKey, !setWatchOnly.empty()))
+            return ISMINE_NO;
+    }
     return ::IsMine(*this, txout.scriptPubKey);
 }
 
@@ -1368,12 +1573,192 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
     }
 }
 
+namespace {
+
+/**
+ * Read-only copy of the key IDs, scripts and watch-only scripts of a wallet,
+ * and of its script filter, so that IsMine can be evaluated from several
+ * threads without cs_KeyStore. Public keys are only needed for witness
+ * outputs whose script the wallet has, and are looked up in the wallet
+ * itself.
+ */
+class CKeyStoreSnapshot : public CKeyStore
+{
+private:
+    const CKeyStore& keystore;
+    std::set<CKeyID> setKeys;
+    ScriptMap mapScripts;
+    WatchOnlySet setWatchOnly;
+    CHashFilter filter;
+
+public:
+    CKeyStoreSnapshot(const CKeyStore& keystoreIn, const ScriptMap& mapScriptsIn, const WatchOnlySet& setWatchOnlyIn, const CHashFilter& filterIn) :
+        keystore(keystoreIn), mapScripts(mapScriptsIn), setWatchOnly(setWatchOnlyIn), filter(filterIn)
+    {
+        keystore.GetKeys(setKeys);
+    }
+
+    bool MayBeMine(const CScript& scriptPubKey) const { return ::MayBeMine(filter, scriptPubKey, !setWatchOnly.empty()); }
+
+    bool AddKeyPubKey(const CKey &key, const CPubKey &pubkey) { return false; }
+    bool HaveKey(const CKeyID &address) const { return setKeys.count(address) > 0; }
+    bool GetKey(const CKeyID &address, CKey& keyOut) const { return false; }
+    void GetKeys(std::set<CKeyID> &setAddress) const { setAddress = setKeys; }
+    bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const { return keystore.GetPubKey(address, vchPubKeyOut); }
+
+    bool AddCScript(const CScript& redeemScript) { return false; }
+    bool HaveCScript(const CScriptID &hash) const { return mapScripts.count(hash) > 0; }
+    bool GetCScript(const CScriptID &hash, CScript& redeemScriptOut) const
+    {
+        ScriptMap::const_iterator mi = mapScripts.find(hash);
+        if (mi == mapScripts.end())
+            return false;
+        redeemScriptOut = mi->second;
+        return true;
+    }
+
+    bool AddWatchOnly(const CScript &dest) { return false; }
+    bool RemoveWatchOnly(const CScript &dest) { return false; }
+    bool HaveWatchOnly(const CScript &dest) const { return setWatchOnly.count(dest) > 0; }
+    bool HaveWatchOnly() const { return !setWatchOnly.empty(); }
+};
+
+/**
+ * Blocks of a rescan, read from disk and matched against a keystore snapshot
+ * by worker threads, in a window of blocks ahead of the one being committed.
+ *
+ * Worker i reads block i into slot i % size of the window, which is free
+ * once block i - size has been released, and marks the transactions with an
+ * output IsMine. The committing thread takes the blocks in order.
+ */
+class CRescanPipeline
+{
+private:
+    struct Slot {
+        CBlock block;
+        //! Transactions of block with an output that is ours
+        std::vector<bool> vMatch;
+        bool fReady;
+        Slot() : fReady(false) {}
+    };
+
+    const std::vector<CBlockIndex*>& vIndex;
+    const CKeyStoreSnapshot& keystore;
+    const Consensus::Params& consensusParams;
+    std::vector<Slot> vSlots;
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condCommit;
+    //! Next block to hand to a worker
+    size_t nNextRead;
+    //! Next block to commit; the window ends vSlots.size() blocks after it
+    size_t nNextCommit;
+    bool fStop;
+
+    boost::thread_group threadGroup;
+
+    void ThreadRead()
+    {
+        while (true) {
+            size_t nBlock;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNextRead < vIndex.size() && nNextRead >= nNextCommit + vSlots.size())
+                    condWorker.wait(lock);
+                if (fStop || nNextRead >= vIndex.size())
+                    return;
+                nBlock = nNextRead++;
+            }
+
+            // The slot is this worker's until it is marked ready.
+            Slot& slot = vSlots[nBlock % vSlots.size()];
+            ReadBlockFromDisk(slot.block, vIndex[nBlock], consensusParams);
+            slot.vMatch.assign(slot.block.vtx.size(), false);
+            for (size_t i = 0; i < slot.block.vtx.size(); i++) {
+                BOOST_FOREACH(const CTxOut& txout, slot.block.vtx[i].vout) {
+                    if (keystore.MayBeMine(txout.scriptPubKey) && ::IsMine(keystore, txout.scriptPubKey) != ISMINE_NO) {
+                        slot.vMatch[i] = true;
+                        break;
+                    }
+                }
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            slot.fReady = true;
+            condCommit.notify_all();
+        }
+    }
+
+public:
+    CRescanPipeline(const std::vector<CBlockIndex*>& vIndexIn, const CKeyStoreSnapshot& keystoreIn, const Consensus::Params& consensusParamsIn, int nThreads) :
+        vIndex(vIndexIn), keystore(keystoreIn), consensusParams(consensusParamsIn), vSlots(nThreads * 4), nNextRead(0), nNextCommit(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CRescanPipeline::ThreadRead, this));
+    }
+
+    ~CRescanPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            condWorker.notify_all();
+        }
+        threadGroup.join_all();
+    }
+
+    /** Wait for the next block to commit. It stays valid until Release(). */
+    const CBlock& Next(const std::vector<bool>*& pvMatch)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        Slot& slot = vSlots[nNextCommit % vSlots.size()];
+        while (!slot.fReady)
+            condCommit.wait(lock);
+        pvMatch = &slot.vMatch;
+        return slot.block;
+    }
+
+    /** Hand the slot of the block returned by Next() back to the workers */
+    void Release()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        Slot& slot = vSlots[nNextCommit % vSlots.size()];
+        slot.block.SetNull();
+        slot.fReady = false;
+        nNextCommit++;
+        condWorker.notify_all();
+    }
+};
+
+/** Flags a wallet as scanning for as long as it is in scope */
+class CScanningFlag
+{
+private:
+    std::atomic<bool>& fScanning;
+
+public:
+    explicit CScanningFlag(std::atomic<bool>& fScanningIn) : fScanning(fScanningIn) { fScanning = true; }
+    ~CScanningFlag() { fScanning = false; }
+};
+
+} // anon namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read and checked for outputs to the wallet's scripts on
+ * several threads; the transactions that may involve the wallet are then
+ * added in chain order. The scan stops early if AbortRescan() is called or
+ * shutdown is requested.
+ *
+ * If ppindexScanned is given, it is set to the last block the scan covered:
+ * the tip, unless the scan stopped early. It is NULL if the scan stopped
+ * before its first block and that block is the genesis block.
  */
-int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, CBlockIndex** ppindexScanned)
 {
     int ret = 0;
     int64_t nNow = GetTime();
@@ -1382,34 +1767,63 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     CBlockIndex* pindex = pindexStart;
     {
         LOCK2(cs_main, cs_wallet);
+        fAbortRescan = false;
+        CScanningFlag scanning(fScanningWallet);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
+        std::vector<CBlockIndex*> vIndex;
+        for (CBlockIndex* pindexScan = pindex; pindexScan; pindexScan = chainActive.Next(pindexScan))
+            vIndex.push_back(pindexScan);
+        // Blocks before the wallet birthday count as scanned.
+        CBlockIndex* pindexScanned = pindex ? pindex->pprev : chainActive.Tip();
+
+        // The wallet's keys and scripts can't change while cs_wallet is held.
+        boost::scoped_ptr<CKeyStoreSnapshot> snapshot;
+        {
+            LOCK(cs_KeyStore);
+            snapshot.reset(new CKeyStoreSnapshot(*this, mapScripts, setWatchOnly, filterScripts));
+        }
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        int nThreads = std::max(1, std::min(GetNumCores(), MAX_RESCAN_THREADS));
+        CRescanPipeline pipeline(vIndex, *snapshot, chainParams.GetConsensus(), nThreads);
+        for (size_t nBlock = 0; nBlock < vIndex.size(); nBlock++)
         {
+            pindex = vIndex[nBlock];
+            if (fAbortRescan || ShutdownRequested()) {
+                LogPrintf("Rescan aborted at block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                break;
+            }
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            const std::vector<bool>* pvMatch;
+            const CBlock& block = pipeline.Next(pvMatch);
+            for (size_t i = 0; i < block.vtx.size(); i++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                // Transactions that pay none of our scripts can still spend
+                // from the wallet or conflict with a wallet transaction.
+                const CTransaction& tx = block.vtx[i];
+                if (((*pvMatch)[i] || MayInvolveWallet(tx, false)) && AddToWalletIfInvolvingMe(tx, &block, fUpdate))
                     ret++;
             }
-            pindex = chainActive.Next(pindex);
+            pipeline.Release();
+            pindexScanned = pindex;
+
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
             }
         }
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        if (ppindexScanned)
+            *ppindexScanned = pindexScanned;
     }
     return ret;
 }
@@ -1747,9 +2161,8 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1763,9 +2176,8 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1778,9 +2190,8 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1792,9 +2203,8 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1808,9 +2218,8 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1823,9 +2232,8 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetUnspentTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1838,9 +2246,17 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const std::set<COutPoint>& setOutputs = GetUnspent();
+        std::set<COutPoint>::const_iterator itTx = setOutputs.begin(), itNext;
+        for (; itTx != setOutputs.end(); itTx = itNext)
         {
-            const uint256& wtxid = it->first;
+            const uint256 wtxid = itTx->hash;
+            itNext = itTx;
+            while (itNext != setOutputs.end() && itNext->hash == wtxid)
+                ++itNext;
+            std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            if (it == mapWallet.end())
+                continue;
             const CWalletTx* pcoin = &(*it).second;
 
             if (!CheckFinalTx(*pcoin))
@@ -1861,7 +2277,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             if (nDepth == 0 && !pcoin->InMempool())
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            for (std::set<COutPoint>::const_iterator itOut = itTx; itOut != itNext; ++itOut) {
+                unsigned int i = itOut->n;
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
                     !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
@@ -1875,7 +2292,10 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+//! Bound on the coins times iterations one ApproximateBestSubset call goes through
+static const size_t KNAPSACK_MAX_STEPS = 10000000;
+
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -1921,38 +2341,97 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, vector<COutput> vCoins,
-                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+namespace {
+
+/** A spendable output, with what coin selection needs to know about it */
+struct CSelectionCoin
+{
+    pair<const CWalletTx*, unsigned int> coin;
+    CAmount nValue;
+    //! nValue minus the fee to spend the output
+    CAmount nEffectiveValue;
+    int nDepth;
+    bool fFromMe;
+};
+
+struct CompareEffectiveValue
+{
+    bool operator()(const CSelectionCoin& a, const CSelectionCoin& b) const
+    {
+        return a.nEffectiveValue > b.nEffectiveValue;
+    }
+};
+
+/**
+ * Guess at the size of an input spending scriptPubKey. Pay-to-pubkey inputs
+ * carry a signature only; anything else is taken for pay-to-pubkey-hash,
+ * which carries a compressed public key as well. Guessing low only costs
+ * CreateTransaction another pass.
+ */
+unsigned int EstimateInputSize(const CScript& scriptPubKey)
+{
+    if ((scriptPubKey.size() == 35 || scriptPubKey.size() == 67) && scriptPubKey[0] == scriptPubKey.size() - 2 && scriptPubKey.back() == OP_CHECKSIG)
+        return 114;
+    return 148;
+}
+
+/**
+ * Sort the spendable coins of vCoins but those in setExclude by descending
+ * effective value at feeRate. Coins of equal value end up in random order.
+ */
+void BuildSelectionIndex(const vector<COutput>& vCoins, const CFeeRate& feeRate, const set<pair<const CWalletTx*, unsigned int> >& setExclude, vector<CSelectionCoin>& vIndex)
+{
+    vIndex.clear();
+    vIndex.reserve(vCoins.size());
+    BOOST_FOREACH(const COutput& output, vCoins)
+    {
+        if (!output.fSpendable)
+            continue;
+        if (!setExclude.empty() && setExclude.count(make_pair(output.tx, (unsigned int)output.i)))
+            continue;
+        const CTxOut& txout = output.tx->vout[output.i];
+        CSelectionCoin entry;
+        entry.coin = make_pair(output.tx, (unsigned int)output.i);
+        entry.nValue = txout.nValue;
+        entry.nEffectiveValue = txout.nValue - feeRate.GetFee(EstimateInputSize(txout.scriptPubKey));
+        entry.nDepth = output.nDepth;
+        entry.fFromMe = output.tx->IsFromMe(ISMINE_ALL);
+        vIndex.push_back(entry);
+    }
+    random_shuffle(vIndex.begin(), vIndex.end(), GetRandInt);
+    std::sort(vIndex.begin(), vIndex.end(), CompareEffectiveValue());
+}
+
+bool IsEligible(const CSelectionCoin& entry, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors)
+{
+    if (entry.nDepth < (entry.fFromMe ? nConfMine : nConfTheirs))
+        return false;
+    // Only unconfirmed transactions are in the mempool and subject to its chain limits.
+    return entry.nDepth > 0 || mempool.TransactionWithinChainLimit(entry.coin.first->GetHash(), nMaxAncestors);
+}
+
+/** The stochastic selection of SelectCoinsMinConf over an index sorted by value */
+bool SelectCoinsKnapsack(const vector<CSelectionCoin>& vIndex, const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors,
+                         set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet)
 {
     setCoinsRet.clear();
     nValueRet = 0;
 
-    // List of values less than target
+    // List of values less than target, largest first as the index is sorted
     pair<CAmount, pair<const CWalletTx*,unsigned int> > coinLowestLarger;
     coinLowestLarger.first = std::numeric_limits<CAmount>::max();
     coinLowestLarger.second.first = NULL;
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
-    BOOST_FOREACH(const COutput &output, vCoins)
+    BOOST_FOREACH(const CSelectionCoin& entry, vIndex)
     {
-        if (!output.fSpendable)
+        if (!IsEligible(entry, nConfMine, nConfTheirs, nMaxAncestors))
             continue;
 
-        const CWalletTx *pcoin = output.tx;
+        CAmount n = entry.nValue;
 
-        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
-            continue;
-
-        if (!mempool.TransactionWithinChainLimit(pcoin->GetHash(), nMaxAncestors))
-            continue;
-
-        int i = output.i;
-        CAmount n = pcoin->vout[i].nValue;
-
-        pair<CAmount,pair<const CWalletTx*,unsigned int> > coin = make_pair(n,make_pair(pcoin, i));
+        pair<CAmount,pair<const CWalletTx*,unsigned int> > coin = make_pair(n, entry.coin);
 
         if (n == nTargetValue)
         {
@@ -1990,15 +2469,14 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
-    std::sort(vValue.begin(), vValue.end(), CompareValueOnly());
-    std::reverse(vValue.begin(), vValue.end());
+    // Solve subset sum by stochastic approximation, in bounded time however many coins there are
+    int nIterations = std::max<size_t>(10, std::min<size_t>(1000, KNAPSACK_MAX_STEPS / std::max<size_t>(1, vValue.size())));
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest);
+    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest);
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest, nIterations);
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -2026,14 +2504,71 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
     return true;
 }
 
-bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+/**
+ * Select coins whose effective values add up to nTargetEffective plus at
+ * most params.nCostOfChange, over an index sorted by effective value.
+ */
+bool SelectCoinsEffective(const vector<CSelectionCoin>& vIndex, const CAmount& nTargetEffective, const CCoinSelectionParams& params,
+                          int nConfMine, int nConfTheirs, uint64_t nMaxAncestors,
+                          set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet)
+{
+    setCoinsRet.clear();
+    nValueRet = 0;
+
+    vector<CAmount> vValues;
+    vector<size_t> vPositions;
+    for (size_t i = 0; i < vIndex.size(); i++)
+    {
+        // The rest cost more to spend than they are worth.
+        if (vIndex[i].nEffectiveValue <= 0)
+            break;
+        if (!IsEligible(vIndex[i], nConfMine, nConfTheirs, nMaxAncestors))
+            continue;
+        vValues.push_back(vIndex[i].nEffectiveValue);
+        vPositions.push_back(i);
+    }
+
+    vector<size_t> vSelected;
+    CAmount nEffectiveRet;
+    if (!SelectCoinsBnB(vValues, nTargetEffective, params.nCostOfChange, vSelected, nEffectiveRet))
+        return false;
+
+    BOOST_FOREACH(size_t i, vSelected)
+    {
+        const CSelectionCoin& entry = vIndex[vPositions[i]];
+        setCoinsRet.insert(entry.coin);
+        nValueRet += entry.nValue;
+    }
+    LogPrint("selectcoins", "SelectCoins() branch and bound: %u coins, effective value %s for target %s\n",
+             vSelected.size(), FormatMoney(nEffectiveRet), FormatMoney(nTargetEffective));
+    return true;
+}
+
+bool SelectCoinsTier(const vector<CSelectionCoin>& vIndex, const CAmount& nTargetValue, const CCoinSelectionParams* params,
+                     int nConfMine, int nConfTheirs, uint64_t nMaxAncestors,
+                     set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet)
 {
-    vector<COutput> vCoins(vAvailableCoins);
+    if (params)
+        return SelectCoinsEffective(vIndex, nTargetValue, *params, nConfMine, nConfTheirs, nMaxAncestors, setCoinsRet, nValueRet);
+    return SelectCoinsKnapsack(vIndex, nTargetValue, nConfMine, nConfTheirs, nMaxAncestors, setCoinsRet, nValueRet);
+}
+
+} // anon namespace
+
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, const vector<COutput>& vCoins,
+                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+{
+    vector<CSelectionCoin> vIndex;
+    BuildSelectionIndex(vCoins, CFeeRate(0), set<pair<const CWalletTx*,unsigned int> >(), vIndex);
+    return SelectCoinsKnapsack(vIndex, nTargetValue, nConfMine, nConfTheirs, nMaxAncestors, setCoinsRet, nValueRet);
+}
 
+bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, const CCoinSelectionParams* params) const
+{
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs)
     {
-        BOOST_FOREACH(const COutput& out, vCoins)
+        BOOST_FOREACH(const COutput& out, vAvailableCoins)
         {
             if (!out.fSpendable)
                  continue;
@@ -2046,6 +2581,7 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
     // calculate value from preset inputs and store them
     set<pair<const CWalletTx*, uint32_t> > setPresetCoins;
     CAmount nValueFromPresetInputs = 0;
+    CAmount nEffectiveFromPresetInputs = 0;
 
     std::vector<COutPoint> vPresetInputs;
     if (coinControl)
@@ -2060,33 +2596,41 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
             if (pcoin->vout.size() <= outpoint.n)
                 return false;
             nValueFromPresetInputs += pcoin->vout[outpoint.n].nValue;
+            if (params)
+                nEffectiveFromPresetInputs += pcoin->vout[outpoint.n].nValue - params->feeRate.GetFee(EstimateInputSize(pcoin->vout[outpoint.n].scriptPubKey));
             setPresetCoins.insert(make_pair(pcoin, outpoint.n));
         } else
             return false; // TODO: Allow non-wallet inputs
     }
 
-    // remove preset inputs from vCoins
-    for (vector<COutput>::iterator it = vCoins.begin(); it != vCoins.end() && coinControl && coinControl->HasSelected();)
-    {
-        if (setPresetCoins.count(make_pair(it->tx, it->i)))
-            it = vCoins.erase(it);
-        else
-            ++it;
-    }
+    // sort the other coins once for all the attempts below
+    vector<CSelectionCoin> vIndex;
+    BuildSelectionIndex(vAvailableCoins, params ? params->feeRate : CFeeRate(0), setPresetCoins, vIndex);
 
     size_t nMaxChainLength = std::min(GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT), GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT));
     bool fRejectLongChains = GetBoolArg("-walletrejectlongchains", DEFAULT_WALLET_REJECT_LONG_CHAINS);
 
-    bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet));
+    // what the coins still have to add up to, and whether the preset inputs cover it already
+    CAmount nTargetRemaining = nTargetValue - nValueFromPresetInputs;
+    bool fPresetEnough = nTargetRemaining <= 0;
+    if (params)
+    {
+        nTargetRemaining = nTargetValue + params->nFeeNoInputs - nEffectiveFromPresetInputs;
+        fPresetEnough = nTargetRemaining <= 0 && -nTargetRemaining <= params->nCostOfChange;
+        if (nTargetRemaining <= 0 && !fPresetEnough)
+            return false;
+    }
 
-    // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
+    bool res = fPresetEnough ||
+        SelectCoinsTier(vIndex, nTargetRemaining, params, 1, 6, 0, setCoinsRet, nValueRet) ||
+        SelectCoinsTier(vIndex, nTargetRemaining, params, 1, 1, 0, setCoinsRet, nValueRet) ||
+        (bSpendZeroConfChange && SelectCoinsTier(vIndex, nTargetRemaining, params, 0, 1, 2, setCoinsRet, nValueRet)) ||
+        (bSpendZeroConfChange && SelectCoinsTier(vIndex, nTargetRemaining, params, 0, 1, std::min((size_t)4, nMaxChainLength/3), setCoinsRet, nValueRet)) ||
+        (bSpendZeroConfChange && SelectCoinsTier(vIndex, nTargetRemaining, params, 0, 1, nMaxChainLength/2, setCoinsRet, nValueRet)) ||
+        (bSpendZeroConfChange && SelectCoinsTier(vIndex, nTargetRemaining, params, 0, 1, nMaxChainLength, setCoinsRet, nValueRet)) ||
+        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsTier(vIndex, nTargetRemaining, params, 0, 1, std::numeric_limits<uint64_t>::max(), setCoinsRet, nValueRet));
+
+    // because SelectCoinsTier clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
 
     // add preset inputs to the total value selected
@@ -2208,6 +2752,28 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
             std::vector<COutput> vAvailableCoins;
             AvailableCoins(vAvailableCoins, true, coinControl);
 
+            // First look for inputs that pay the fee with too little left for
+            // a change output, estimating the fee from effective values.
+            // Otherwise select with change and settle the fee over several
+            // passes as usual.
+            bool fUseBnB = nSubtractFeeFromAmount == 0 && !fSendFreeTransactions &&
+                !(coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs);
+            CCoinSelectionParams selectionParams;
+            if (fUseBnB)
+            {
+                if (coinControl && coinControl->fOverrideFeeRate)
+                    selectionParams.feeRate = coinControl->nFeeRate;
+                else
+                    selectionParams.feeRate = CFeeRate(GetMinimumFee(1000, nTxConfirmTarget, mempool));
+                // version, locktime and the input and output counts
+                unsigned int nBytesNoInputs = 10;
+                BOOST_FOREACH (const CRecipient& recipient, vecSend)
+                    nBytesNoInputs += ::GetSerializeSize(CTxOut(recipient.nAmount, recipient.scriptPubKey), SER_NETWORK, PROTOCOL_VERSION);
+                selectionParams.nFeeNoInputs = selectionParams.feeRate.GetFee(nBytesNoInputs);
+                // a pay-to-pubkey-hash output and the input spending it
+                selectionParams.nCostOfChange = selectionParams.feeRate.GetFee(34) + selectionParams.feeRate.GetFee(148);
+            }
+
             nFeeRet = 0;
             // Start with no fee and loop until there is enough fee
             while (true)
@@ -2258,8 +2824,13 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Choose coins to use
                 set<pair<const CWalletTx*,unsigned int> > setCoins;
                 CAmount nValueIn = 0;
-                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl))
+                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl, fUseBnB ? &selectionParams : NULL))
                 {
+                    if (fUseBnB)
+                    {
+                        fUseBnB = false;
+                        continue;
+                    }
                     strFailReason = _("Insufficient funds");
                     return false;
                 }
@@ -2278,7 +2849,14 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 }
 
                 const CAmount nChange = nValueIn - nValueToSelect;
-                if (nChange > 0)
+                if (fUseBnB)
+                {
+                    // The inputs were chosen for all of the excess to go to the fee.
+                    nChangePosInOut = -1;
+                    nFeeRet += nChange;
+                    reservekey.ReturnKey();
+                }
+                else if (nChange > 0)
                 {
                     // Fill a vout to ourself
                     // TODO: pass in scriptChange instead of reservekey so
@@ -2447,6 +3025,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
 
                 // Include more fee and try again.
                 nFeeRet = nFeeNeeded;
+                fUseBnB = false;
                 continue;
             }
         }
@@ -2522,6 +3101,384 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
     return true;
 }
 
+namespace {
+
+/**
+ * Signs the inputs of a batch of transactions on worker threads, each taking
+ * the next input left until there are none. The signatures are applied to
+ * the transactions by the caller afterwards.
+ */
+class CBatchSigner
+{
+private:
+    const CKeyStore& keystore;
+    //! Unsigned transactions, and the outputs spent by their inputs
+    const std::vector<CTransaction>& vtx;
+    const std::vector<std::vector<CTxOut> >& vSpent;
+    std::vector<std::pair<size_t, unsigned int> > vInputs;
+    //! Position in vInputs of the first input of every transaction
+    std::vector<size_t> vFirstInput;
+    std::atomic<size_t> nNext;
+
+    void ThreadSign()
+    {
+        while (true) {
+            size_t i = nNext++;
+            if (i >= vInputs.size())
+                return;
+            size_t nTx = vInputs[i].first;
+            unsigned int nIn = vInputs[i].second;
+            const CTxOut& txout = vSpent[nTx][nIn];
+            vfSigned[i] = ProduceSignature(TransactionSignatureCreator(&keystore, &vtx[nTx], nIn, txout.nValue, SIGHASH_ALL), txout.scriptPubKey, vSigData[i]);
+        }
+    }
+
+public:
+    std::vector<SignatureData> vSigData;
+    std::vector<char> vfSigned;
+
+    CBatchSigner(const CKeyStore& keystoreIn, const std::vector<CTransaction>& vtxIn, const std::vector<std::vector<CTxOut> >& vSpentIn) :
+        keystore(keystoreIn), vtx(vtxIn), vSpent(vSpentIn), nNext(0)
+    {
+        for (size_t nTx = 0; nTx < vtx.size(); nTx++) {
+            vFirstInput.push_back(vInputs.size());
+            for (unsigned int nIn = 0; nIn < vtx[nTx].vin.size(); nIn++)
+                vInputs.push_back(std::make_pair(nTx, nIn));
+        }
+        vSigData.resize(vInputs.size());
+        vfSigned.assign(vInputs.size(), false);
+    }
+
+    /** Sign all inputs and return whether every one could be */
+    bool Sign(int nThreads)
+    {
+        if (nThreads <= 1) {
+            ThreadSign();
+        } else {
+            boost::thread_group threadGroup;
+            for (int i = 0; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&CBatchSigner::ThreadSign, this));
+            threadGroup.join_all();
+        }
+        return std::find(vfSigned.begin(), vfSigned.end(), false) == vfSigned.end();
+    }
+
+    /** Put the signatures of transaction nTx into tx */
+    void Update(size_t nTx, CMutableTransaction& tx) const
+    {
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+            UpdateTransaction(tx, nIn, vSigData[vFirstInput[nTx] + nIn]);
+    }
+};
+
+} // anon namespace
+
+bool CWallet::CreatePayoutTransactions(const vector<CRecipient>& vecSend, vector<CWalletTx>& vwtxNew, vector<boost::shared_ptr<CReserveKey> >& vReserveKeys,
+                                       CAmount& nFeeRet, std::string& strFailReason)
+{
+    vwtxNew.clear();
+    vReserveKeys.clear();
+    nFeeRet = 0;
+
+    if (vecSend.empty())
+    {
+        strFailReason = _("Transaction must have at least one recipient");
+        return false;
+    }
+    BOOST_FOREACH (const CRecipient& recipient, vecSend)
+    {
+        if (recipient.nAmount < 0)
+        {
+            strFailReason = _("Transaction amounts must be positive");
+            return false;
+        }
+        if (recipient.fSubtractFeeFromAmount)
+        {
+            strFailReason = _("Payouts can't subtract the fee from amounts");
+            return false;
+        }
+        if (CTxOut(recipient.nAmount, recipient.scriptPubKey).IsDust(::minRelayTxFee))
+        {
+            strFailReason = _("Transaction amount too small");
+            return false;
+        }
+    }
+
+    const unsigned int nMaxSize = MAX_STANDARD_TX_WEIGHT / WITNESS_SCALE_FACTOR;
+    std::vector<CMutableTransaction> vtxNew;
+    std::vector<std::vector<CTxOut> > vSpent;
+
+    LOCK2(cs_main, cs_wallet);
+
+    // Coins are selected from one index for the whole batch, and only among
+    // confirmed outputs, so the transactions never depend on each other.
+    std::vector<COutput> vAvailableCoins;
+    AvailableCoins(vAvailableCoins, true);
+    CFeeRate feeRate(GetMinimumFee(1000, nTxConfirmTarget, mempool));
+    vector<CSelectionCoin> vIndex;
+    BuildSelectionIndex(vAvailableCoins, feeRate, set<pair<const CWalletTx*,unsigned int> >(), vIndex);
+
+    size_t nNext = 0;
+    while (nNext < vecSend.size())
+    {
+        // Start with the recipients whose outputs fill half a transaction,
+        // leaving the rest for the inputs, and halve that if it turns out too large.
+        size_t nEnd = nNext;
+        unsigned int nOutputsSize = 0;
+        while (nEnd < vecSend.size())
+        {
+            unsigned int nSize = ::GetSerializeSize(CTxOut(vecSend[nEnd].nAmount, vecSend[nEnd].scriptPubKey), SER_NETWORK, PROTOCOL_VERSION);
+            if (nEnd > nNext && nOutputsSize + nSize > nMaxSize / 2)
+                break;
+            nOutputsSize += nSize;
+            nEnd++;
+        }
+
+        CAmount nExtraFee = 0;
+        while (true)
+        {
+            CMutableTransaction txNew;
+            txNew.nLockTime = chainActive.Height();
+            CAmount nValue = 0;
+            for (size_t i = nNext; i < nEnd; i++)
+            {
+                txNew.vout.push_back(CTxOut(vecSend[i].nAmount, vecSend[i].scriptPubKey));
+                nValue += vecSend[i].nAmount;
+            }
+            unsigned int nBytesNoInputs = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
+
+            // Inputs that need no change output, or else inputs covering the
+            // outputs and the fee of the transaction with change.
+            CCoinSelectionParams params;
+            params.feeRate = feeRate;
+            params.nFeeNoInputs = feeRate.GetFee(nBytesNoInputs) + nExtraFee;
+            params.nCostOfChange = feeRate.GetFee(34) + feeRate.GetFee(148);
+            set<pair<const CWalletTx*,unsigned int> > setCoins;
+            CAmount nValueIn = 0;
+            bool fChange = !(SelectCoinsEffective(vIndex, nValue + params.nFeeNoInputs, params, 1, 6, 0, setCoins, nValueIn) ||
+                             SelectCoinsEffective(vIndex, nValue + params.nFeeNoInputs, params, 1, 1, 0, setCoins, nValueIn));
+            CAmount nFee = nValueIn - nValue;
+            if (fChange)
+            {
+                CAmount nTarget = nValue + feeRate.GetFee(nBytesNoInputs + 34) + nExtraFee;
+                while (true)
+                {
+                    if (!SelectCoinsKnapsack(vIndex, nTarget, 1, 6, 0, setCoins, nValueIn) &&
+                        !SelectCoinsKnapsack(vIndex, nTarget, 1, 1, 0, setCoins, nValueIn))
+                    {
+                        strFailReason = _("Insufficient funds");
+                        return false;
+                    }
+                    unsigned int nBytes = nBytesNoInputs + 34;
+                    BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setCoins)
+                        nBytes += EstimateInputSize(coin.first->vout[coin.second].scriptPubKey);
+                    nFee = feeRate.GetFee(nBytes) + nExtraFee;
+                    if (nValueIn >= nValue + nFee)
+                        break;
+                    nTarget = nValue + nFee;
+                }
+
+                CReserveKey* pReserveKey = new CReserveKey(this);
+                vReserveKeys.push_back(boost::shared_ptr<CReserveKey>(pReserveKey));
+                CTxOut changeTxOut(nValueIn - nValue - nFee, CScript());
+                CPubKey vchPubKey;
+                if (!pReserveKey->GetReservedKey(vchPubKey))
+                {
+                    strFailReason = _("Keypool ran out, please call keypoolrefill first");
+                    return false;
+                }
+                changeTxOut.scriptPubKey = GetScriptForDestination(vchPubKey.GetID());
+                if (changeTxOut.IsDust(::minRelayTxFee))
+                {
+                    nFee += changeTxOut.nValue;
+                    pReserveKey->ReturnKey();
+                }
+                else
+                    txNew.vout.insert(txNew.vout.begin() + GetRandInt(txNew.vout.size() + 1), changeTxOut);
+            }
+            else
+                vReserveKeys.push_back(boost::shared_ptr<CReserveKey>(new CReserveKey(this)));
+
+            std::vector<CTxOut> vTxSpent;
+            BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setCoins)
+            {
+                txNew.vin.push_back(CTxIn(coin.first->GetHash(), coin.second, CScript(), std::numeric_limits<unsigned int>::max() - 1));
+                vTxSpent.push_back(coin.first->vout[coin.second]);
+            }
+
+            // Measure the transaction with dummy signatures, which are no
+            // smaller than real ones.
+            CMutableTransaction txDummy(txNew);
+            for (unsigned int nIn = 0; nIn < txDummy.vin.size(); nIn++)
+            {
+                SignatureData sigdata;
+                if (!ProduceSignature(DummySignatureCreator(this), vTxSpent[nIn].scriptPubKey, sigdata))
+                {
+                    strFailReason = _("Signing transaction failed");
+                    return false;
+                }
+                UpdateTransaction(txDummy, nIn, sigdata);
+            }
+            unsigned int nBytes = GetVirtualTransactionSize(txDummy);
+
+            if (GetTransactionWeight(txDummy) >= MAX_STANDARD_TX_WEIGHT)
+            {
+                vReserveKeys.back()->ReturnKey();
+                vReserveKeys.pop_back();
+                if (nEnd - nNext == 1)
+                {
+                    strFailReason = _("Transaction too large");
+                    return false;
+                }
+                nEnd = nNext + (nEnd - nNext) / 2;
+                nExtraFee = 0;
+                continue;
+            }
+
+            CAmount nFeeNeeded = GetMinimumFee(nBytes, nTxConfirmTarget, mempool);
+            if (nFeeNeeded < ::minRelayTxFee.GetFee(nBytes))
+            {
+                strFailReason = _("Transaction too large for fee policy");
+                return false;
+            }
+            if (nFee < nFeeNeeded)
+            {
+                // The input size estimates were short; select again for the difference.
+                vReserveKeys.back()->ReturnKey();
+                vReserveKeys.pop_back();
+                nExtraFee += nFeeNeeded - nFee;
+                continue;
+            }
+
+            // Take the coins out of the index for the transactions still to come.
+            vector<CSelectionCoin>::iterator itEnd = vIndex.begin();
+            for (vector<CSelectionCoin>::iterator it = vIndex.begin(); it != vIndex.end(); ++it)
+                if (!setCoins.count(it->coin))
+                    *itEnd++ = *it;
+            vIndex.erase(itEnd, vIndex.end());
+
+            vtxNew.push_back(txNew);
+            vSpent.push_back(vTxSpent);
+            nFeeRet += nFee;
+            break;
+        }
+        nNext = nEnd;
+    }
+
+    std::vector<CTransaction> vtxUnsigned(vtxNew.begin(), vtxNew.end());
+    CBatchSigner signer(*this, vtxUnsigned, vSpent);
+    size_t nInputs = signer.vfSigned.size();
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_PAYOUT_SIGN_THREADS));
+    if ((size_t)nThreads > nInputs)
+        nThreads = std::max<size_t>(1, nInputs);
+    if (!signer.Sign(nThreads))
+    {
+        strFailReason = _("Signing transaction failed");
+        return false;
+    }
+
+    vwtxNew.resize(vtxNew.size());
+    for (size_t i = 0; i < vtxNew.size(); i++)
+    {
+        signer.Update(i, vtxNew[i]);
+        CWalletTx& wtxNew = vwtxNew[i];
+        wtxNew.fTimeReceivedIsTxTime = true;
+        wtxNew.BindWallet(this);
+        wtxNew.fFromMe = true;
+        *static_cast<CTransaction*>(&wtxNew) = CTransaction(vtxNew[i]);
+    }
+    LogPrintf("CreatePayoutTransactions: %u recipients in %u transactions with %u inputs, fee %s\n",
+              vecSend.size(), vwtxNew.size(), nInputs, FormatMoney(nFeeRet));
+    return true;
+}
+
+bool CWallet::CommitTransactions(vector<CWalletTx>& vwtxNew, vector<boost::shared_ptr<CReserveKey> >& vReserveKeys)
+{
+    {
+        LOCK2(cs_main, cs_wallet);
+
+        // Give the transactions their order positions up front, so that they
+        // are written exactly as they will be held in memory.
+        int64_t nOrderPos = nOrderPosNext;
+        const int64_t nTimeReceived = GetAdjustedTime();
+        BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+        {
+            wtxNew.BindWallet(this);
+            wtxNew.nTimeReceived = nTimeReceived;
+            wtxNew.nTimeSmart = nTimeReceived;
+            wtxNew.nOrderPos = nOrderPos++;
+        }
+
+        // Write all of them in one database transaction. Nothing changes in
+        // memory, and no key leaves the key pool, unless it commits.
+        if (fFileBacked)
+        {
+            CWalletDB walletdb(strWalletFile, "r+");
+            if (!walletdb.TxnBegin())
+                return false;
+            bool fWritten = walletdb.WriteOrderPosNext(nOrderPos);
+            for (size_t i = 0; fWritten && i < vwtxNew.size(); i++)
+                fWritten = walletdb.WriteTx(vwtxNew[i]);
+            if (!fWritten)
+                walletdb.TxnAbort();
+            if (!fWritten || !walletdb.TxnCommit())
+            {
+                LogPrintf("CommitTransactions(): writing %u transactions failed\n", vwtxNew.size());
+                return false;
+            }
+        }
+        nOrderPosNext = nOrderPos;
+
+        std::string strCmd = GetArg("-walletnotify", "");
+        BOOST_FOREACH(const CWalletTx& wtxNew, vwtxNew)
+        {
+            const uint256 hash = wtxNew.GetHash();
+            LogPrintf("CommitTransactions: %s\n", hash.ToString());
+
+            // Already written, so added the way loading the wallet adds it
+            AddToWallet(wtxNew, true, NULL);
+            UpdateUnspent(mapWallet[hash]);
+            NotifyTransactionChanged(this, hash, CT_NEW);
+
+            // Notify that old coins are spent
+            BOOST_FOREACH(const CTxIn& txin, wtxNew.vin)
+            {
+                CWalletTx &coin = mapWallet[txin.prevout.hash];
+                coin.BindWallet(this);
+                NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
+            }
+
+            if (!strCmd.empty())
+            {
+                std::string strTxCmd = strCmd;
+                boost::replace_all(strTxCmd, "%s", hash.GetHex());
+                boost::thread t(runCommand, strTxCmd); // thread runs free
+            }
+        }
+
+        // Take the change keys from the key pool so they won't be used again
+        BOOST_FOREACH(boost::shared_ptr<CReserveKey>& reservekey, vReserveKeys)
+            reservekey->KeepKey();
+
+        BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+        {
+            // Track how many getdata requests our transaction gets
+            mapRequestCount[wtxNew.GetHash()] = 0;
+
+            if (fBroadcastTransactions)
+            {
+                CValidationState state;
+                if (!wtxNew.AcceptToMemoryPool(false, maxTxFee, state)) {
+                    LogPrintf("CommitTransactions(): Transaction %s cannot be broadcast immediately, %s\n", wtxNew.GetHash().ToString(), state.GetRejectReason());
+                } else {
+                    wtxNew.RelayWalletTransaction();
+                }
+            }
+        }
+    }
+    return true;
+}
+
 bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB & pwalletdb)
 {
     if (!pwalletdb.WriteAccountingEntry_Backend(acentry))
@@ -2584,6 +3541,13 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    {
+        // Built once everything is loaded, as watch-only scripts are read
+        // after the transactions.
+        LOCK(cs_wallet);
+        RebuildUnspent();
+    }
+
     uiInterface.LoadWallet(this);
 
     return DB_LOAD_OK;
@@ -3419,9 +4383,12 @@ bool CWallet::InitLoadWallet()
         uiInterface.InitMessage(_("Rescanning..."));
         LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
         nStart = GetTimeMillis();
-        walletInstance->ScanForWalletTransactions(pindexRescan, true);
+        CBlockIndex* pindexScanned = NULL;
+        walletInstance->ScanForWalletTransactions(pindexRescan, true, &pindexScanned);
         LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
-        walletInstance->SetBestChain(chainActive.GetLocator());
+        // After an aborted rescan, the next start rescans the blocks it missed.
+        if (pindexScanned)
+            walletInstance->SetBestChain(chainActive.GetLocator(pindexScanned));
         nWalletDBUpdated++;
 
         // Restore wallet transaction metadata after -zapwallettxes=1
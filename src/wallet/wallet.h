@@ -13,11 +13,14 @@
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 #include "script/ismine.h"
+#include "wallet/coinselection.h"
 #include "wallet/crypter.h"
 #include "wallet/walletdb.h"
+#include "wallet/walletfilter.h"
 #include "wallet/rpcwallet.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -62,6 +65,11 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 //! if set, all keys will be derived by using BIP32
 static const bool DEFAULT_USE_HD_WALLET = true;
 
+//! Maximum number of threads reading blocks for a rescan
+static const int MAX_RESCAN_THREADS = 8;
+//! Maximum number of threads signing the inputs of a payout batch
+static const int MAX_PAYOUT_SIGN_THREADS = 8;
+
 extern const char * DEFAULT_WALLET_DAT;
 
 class CBlockIndex;
@@ -549,9 +557,10 @@ private:
     /**
      * Select a set of coins such that nValueRet >= nTargetValue and at least
      * all coins from coinControl are selected; Never select unconfirmed coins
-     * if they are not ours
+     * if they are not ours. With params, only accept a selection whose
+     * effective value leaves no change worth an output (see SelectCoinsBnB)
      */
-    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL, const CCoinSelectionParams *params = NULL) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -583,6 +592,54 @@ private:
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
+    std::atomic<bool> fAbortRescan;
+    std::atomic<bool> fScanningWallet;
+
+    /**
+     * Key IDs, redeem script IDs and watch-only script IDs, so that IsMine
+     * can skip outputs that pay none of them. Guarded by cs_KeyStore.
+     */
+    CHashFilter filterScripts;
+    /**
+     * Txids of wallet transactions and the outpoints they spend, so that
+     * transactions that don't touch the wallet are skipped before looking
+     * up their inputs. Guarded by cs_wallet.
+     */
+    CHashFilter filterCoins;
+    void AddToScriptFilter(const uint160& hash);
+    void AddToScriptFilter(const CScript& watchOnly);
+    void RebuildScriptFilter();
+    void AddToCoinFilter(const uint256& txid);
+    void AddToCoinFilter(const COutPoint& outpoint);
+    void RebuildCoinFilter();
+    /**
+     * False if tx can't be added by AddToWalletIfInvolvingMe: it is not in the
+     * wallet, spends neither a wallet transaction nor an outpoint one spends,
+     * and (with fCheckOutputs) pays none of our scripts.
+     */
+    bool MayInvolveWallet(const CTransaction& tx, bool fCheckOutputs = true) const;
+
+    /**
+     * Outputs of wallet transactions that are ours and that no wallet
+     * transaction spends, apart from abandoned or conflicted ones. This is a
+     * superset of the unspent outputs, ordered like mapWallet, so that the
+     * balances and AvailableCoins only visit transactions with something left
+     * to spend. Guarded by cs_wallet.
+     *
+     * New keys and scripts can make outputs already in the wallet ours, so
+     * adding them marks the set dirty and it is rebuilt when next read.
+     */
+    mutable std::set<COutPoint> setUnspent;
+    mutable bool fUnspentDirty;
+    void UpdateUnspent(const COutPoint& outpoint) const;
+    /** Update the outputs of wtx and the ones it spends in setUnspent */
+    void UpdateUnspent(const CWalletTx& wtx) const;
+    void RebuildUnspent() const;
+    /** setUnspent, rebuilt first if it is dirty */
+    const std::set<COutPoint>& GetUnspent() const;
+    /** Wallet transactions with outputs in setUnspent */
+    std::vector<const CWalletTx*> GetUnspentTxs() const;
+
 public:
     /*
      * Main wallet lock.
@@ -634,6 +691,9 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        fAbortRescan = false;
+        fScanningWallet = false;
+        fUnspentDirty = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -670,7 +730,7 @@ public:
      * completion the coin set and corresponding actual target value is
      * assembled
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -688,7 +748,7 @@ public:
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
     //! Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &metadata);
 
@@ -731,10 +791,19 @@ public:
     bool GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bForceNew = false);
 
     void MarkDirty();
+    /**
+     * Rebuild the unspent output index the next time it is read. Call after
+     * importing a key or script that existing wallet transactions may pay.
+     */
+    void MarkUnspentDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
-    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, CBlockIndex** ppindexScanned = NULL);
+    //! Make a rescan in progress stop after the block it is committing
+    void AbortRescan() { fAbortRescan = true; }
+    bool IsAbortingRescan() const { return fAbortRescan; }
+    bool IsScanning() const { return fScanningWallet; }
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -760,6 +829,21 @@ public:
                            std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
 
+    /**
+     * Pay the recipients in as few transactions as the standard size allows,
+     * selecting coins among confirmed outputs once for all of them and
+     * signing the inputs on several threads. The fee is paid by the sender.
+     * vReserveKeys gets the change key of every transaction.
+     */
+    bool CreatePayoutTransactions(const std::vector<CRecipient>& vecSend, std::vector<CWalletTx>& vwtxNew, std::vector<boost::shared_ptr<CReserveKey> >& vReserveKeys,
+                                  CAmount& nFeeRet, std::string& strFailReason);
+    /**
+     * Write transactions to the wallet database in one database transaction
+     * and, once it commits, add them to the wallet, keep their change keys
+     * and broadcast them. On failure the wallet is left as it was.
+     */
+    bool CommitTransactions(std::vector<CWalletTx>& vwtxNew, std::vector<boost::shared_ptr<CReserveKey> >& vReserveKeys);
+
     bool AddAccountingEntry(const CAccountingEntry&, CWalletDB & pwalletdb);
 
     static CFeeRate minTxFee;
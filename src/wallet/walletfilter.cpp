@@ -0,0 +1,88 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/walletfilter.h"
+
+#include "hash.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/script.h"
+#include "script/standard.h"
+
+#include <limits>
+
+void CHashFilter::Reset(unsigned int nCapacityIn)
+{
+    // Four values per word on average keeps false positives under 1%.
+    size_t nWords = 1;
+    while (nWords * 4 < nCapacityIn)
+        nWords *= 2;
+    vWords.assign(nWords, 0);
+    nElements = 0;
+    nCapacity = nWords * 4;
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+}
+
+static uint64_t ScriptHash(const CScript& script, uint64_t k0, uint64_t k1)
+{
+    return CSipHasher(k0, k1).Write(script.empty() ? NULL : &script[0], script.size()).Finalize();
+}
+
+void CHashFilter::insert(const CScript& script)
+{
+    uint64_t nHash = ScriptHash(script, k0, k1);
+    insert(nHash, nHash >> 32);
+}
+
+bool CHashFilter::contains(const CScript& script) const
+{
+    uint64_t nHash = ScriptHash(script, k0, k1);
+    return contains(nHash, nHash >> 32);
+}
+
+bool MayBeMine(const CHashFilter& filter, const CScript& scriptPubKey, bool fWatchOnly)
+{
+    // Any script can be watched.
+    if (fWatchOnly && filter.contains(scriptPubKey))
+        return true;
+
+    if (scriptPubKey.IsPayToScriptHash())
+        return filter.contains(uint160(std::vector<unsigned char>(scriptPubKey.begin() + 2, scriptPubKey.begin() + 22)));
+
+    int nVersion;
+    std::vector<unsigned char> vProgram;
+    if (scriptPubKey.IsWitnessProgram(nVersion, vProgram)) {
+        // IsMine requires the script itself as a redeem script.
+        return nVersion == 0 && (vProgram.size() == 20 || vProgram.size() == 32) && filter.contains(CScriptID(scriptPubKey));
+    }
+
+    if (!scriptPubKey.empty() && scriptPubKey.back() == OP_CHECKMULTISIG)
+        return true;
+
+    CScript::const_iterator pc = scriptPubKey.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vch;
+    if (!scriptPubKey.GetOp(pc, opcode, vch))
+        return false;
+    if (opcode == OP_DUP) {
+        // OP_DUP OP_HASH160 <key ID> OP_EQUALVERIFY OP_CHECKSIG
+        std::vector<unsigned char> vchKeyID;
+        if (!scriptPubKey.GetOp(pc, opcode) || opcode != OP_HASH160)
+            return false;
+        if (!scriptPubKey.GetOp(pc, opcode, vchKeyID) || vchKeyID.size() != 20)
+            return false;
+        if (!scriptPubKey.GetOp(pc, opcode) || opcode != OP_EQUALVERIFY)
+            return false;
+        if (!scriptPubKey.GetOp(pc, opcode) || opcode != OP_CHECKSIG || pc != scriptPubKey.end())
+            return false;
+        return filter.contains(uint160(vchKeyID));
+    }
+    // <pubkey> OP_CHECKSIG
+    if (vch.size() < 33 || vch.size() > 65)
+        return false;
+    if (!scriptPubKey.GetOp(pc, opcode) || opcode != OP_CHECKSIG || pc != scriptPubKey.end())
+        return false;
+    return filter.contains(CPubKey(vch).GetID());
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_WALLETFILTER_H
+#define BITCOIN_WALLET_WALLETFILTER_H
+
+#include "crypto/common.h"
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+class CScript;
+
+/**
+ * Bloom filter over values that are hashes already (key IDs, script IDs,
+ * txids), so they are not hashed again: the first 64 bits of a value pick
+ * a 64-bit word of the filter, the next ones four bits within it. Scripts
+ * are hashed with salted SipHash instead. A lookup reads one word, and with
+ * the filter no fuller than IsFull() allows, fewer than one in a hundred
+ * absent values match.
+ *
+ * Values can't be removed, and the filter doesn't grow by itself: once
+ * IsFull(), its owner should Reset() it to a larger capacity and insert
+ * everything again.
+ */
+class CHashFilter
+{
+private:
+    std::vector<uint64_t> vWords;
+    unsigned int nElements;
+    unsigned int nCapacity;
+    //! SipHash key for scripts, picked by Reset()
+    uint64_t k0, k1;
+
+    static uint64_t Bits(uint64_t nHash)
+    {
+        return (1ULL << (nHash & 63)) | (1ULL << ((nHash >> 6) & 63)) | (1ULL << ((nHash >> 12) & 63)) | (1ULL << ((nHash >> 18) & 63));
+    }
+
+    void insert(uint64_t nWordHash, uint64_t nBitsHash)
+    {
+        vWords[nWordHash & (vWords.size() - 1)] |= Bits(nBitsHash);
+        nElements++;
+    }
+
+    bool contains(uint64_t nWordHash, uint64_t nBitsHash) const
+    {
+        if (vWords.empty())
+            return false;
+        uint64_t nBits = Bits(nBitsHash);
+        return (vWords[nWordHash & (vWords.size() - 1)] & nBits) == nBits;
+    }
+
+    static uint64_t OutPointMix(const COutPoint& outpoint) { return (outpoint.n + 1ULL) * 0x9E3779B97F4A7C15ULL; }
+
+public:
+    CHashFilter() : nElements(0), nCapacity(0), k0(0), k1(0) {}
+
+    /** Empty the filter and size it for nCapacityIn values */
+    void Reset(unsigned int nCapacityIn);
+
+    bool IsFull() const { return nElements >= nCapacity; }
+    unsigned int size() const { return nElements; }
+
+    void insert(const uint160& hash) { insert(ReadLE64(hash.begin()), ReadLE64(hash.begin() + 8)); }
+    bool contains(const uint160& hash) const { return contains(ReadLE64(hash.begin()), ReadLE64(hash.begin() + 8)); }
+    void insert(const uint256& hash) { insert(ReadLE64(hash.begin()), ReadLE64(hash.begin() + 8)); }
+    bool contains(const uint256& hash) const { return contains(ReadLE64(hash.begin()), ReadLE64(hash.begin() + 8)); }
+
+    void insert(const COutPoint& outpoint)
+    {
+        uint64_t nMix = OutPointMix(outpoint);
+        insert(ReadLE64(outpoint.hash.begin()) ^ nMix, ReadLE64(outpoint.hash.begin() + 16) ^ (nMix >> 32));
+    }
+    bool contains(const COutPoint& outpoint) const
+    {
+        uint64_t nMix = OutPointMix(outpoint);
+        return contains(ReadLE64(outpoint.hash.begin()) ^ nMix, ReadLE64(outpoint.hash.begin() + 16) ^ (nMix >> 32));
+    }
+
+    void insert(const CScript& script);
+    bool contains(const CScript& script) const;
+};
+
+/**
+ * Whether IsMine(keystore, scriptPubKey) may be anything but ISMINE_NO, given
+ * a filter holding the key IDs and redeem script IDs of keystore and its
+ * watch-only scripts. It recognizes the same templates as Solver() without
+ * building the solutions, and never returns false for a script that is
+ * ours. Bare multisig is always passed on to IsMine.
+ */
+bool MayBeMine(const CHashFilter& filter, const CScript& scriptPubKey, bool fWatchOnly);
+
+#endif // BITCOIN_WALLET_WALLETFILTER_H